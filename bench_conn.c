@@ -7,32 +7,26 @@
  * software. If not, contact the copyright holder above.
  */
 
+/* For CPU_SETSIZE */
+#define _GNU_SOURCE
+
 #include <interface/mmal/mmal.h>
-#include <interface/mmal/util/mmal_connection.h>
-#include <interface/mmal/util/mmal_util.h>
-#include <interface/mmal/util/mmal_util_params.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <getopt.h>
 #include <errno.h>
+#include <limits.h>
+#include <sched.h>
 
 #include "common.h"
-
-static void cb_control(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
-{
-    print_info("Called by %s\n", port->name);
-    mmal_buffer_header_release(buffer);
-}
-
-static void cb_conn(MMAL_CONNECTION_T *conn)
-{
-    print_info("Called by %s\n", conn->name);
-}
+#include "bench_pipeline.h"
 
 static char *progname = NULL;
 
 static void usage(void)
 {
-    /* xxx: -z: zero copy */
     printf("Usage: %s [OPTION]...\n", progname);
     printf(""
             "\n"
@@ -41,27 +35,123 @@ static void usage(void)
             "\n"
             " General image options:\n"
             "\n"
-            "  -e ENC        Encoding of a frame (default: opaque)\n"
-            "                Must be one of: i420, opaque\n"
+            "  -e ENC        Encoding of a frame (default: i420)\n"
+            "                Must be one of: i420, rgba, opaque, rgb24, bgr24, yuyv,\n"
+            "                                nv12\n"
             "  -w WIDTH\n"
             "  -h HEIGHT     Size of a frame to produce (default: 1920x1080)\n"
+            "                -e, -w, -h, -d and -c take comma-separated lists too,\n"
+            "                e.g. -w 640,1280,1920 -c tunnel,callback,queue, and\n"
+            "                every combination of them is run in turn\n"
+            "  -r WxH,...    Sizes to run in turn instead of every combination of -w\n"
+            "                and -h, e.g. -r 1916x1076,1920x1080,1920x1088 to see the\n"
+            "                bandwidth lost to the padding to 32x16\n"
+            "  -f FPS        Frame rate to ask the source for (default: as fast as it can)\n"
             "  -t MSEC       Run MMAL connection for MSEC milliseconds (default: 1000)\n"
+            "  -N FRAMES     End the run once FRAMES frames reach the dest, or after\n"
+            "                -t MSEC if it comes first (default: 60000 with -N)\n"
+            "  --warmup=MSEC Run MSEC milliseconds before measuring (default: 0)\n"
 
             "\n"
             " MMAL component options:\n"
             "\n"
             "  -s SOURCE     Source component to use (default: source)\n"
-            "                Must be one of: source, camera\n"
+            "                Must be one of: source, camera, decode, file\n"
+            "                decode feeds --stream in a loop to vc.ril.video_decode,\n"
+            "                whose frames must be of -w x -h; file feeds the raw\n"
+            "                frames of -e ENC and -w x -h in --stream in a loop to\n"
+            "                the next component, and -s file:PATH sets --stream too.\n"
+            "                The buffers point into the file without -z and are\n"
+            "                copied to with it.  -f is ignored for both\n"
+            "  --stream=FILE Stream for the decode and file sources; it is mapped\n"
+            "                into memory beforehand so no file is read in the run\n"
+            "  --codec=CODEC Codec of --stream (default: h264)\n"
+            "                Must be one of: h264, mjpeg\n"
             "  -p PATTERN    Source pattern to produce (default: white)\n"
             "                Must be one of: white, black, diagonal, noise, random, colour,\n"
             "                                blocks, swirly\n"
             "  -n CAMERA     Camera number to use (default: -1 (not set))\n"
+            "                Takes one per instance too, e.g. -n 0,1 --instances 2\n"
             "  -o PORT       Camera output port to use (default: 0)\n"
             "                0:preview 1:video 2:capture\n"
             "  -d DEST       Destination component to use (default: null)\n"
-            "                Must be one of: null, render\n"
+            "                Must be one of: null, render, h264, mjpeg, jpeg, file\n"
+            "                h264 and mjpeg are vc.ril.video_encode and jpeg is\n"
+            "                vc.ril.image_encode; the dest stats count what they\n"
+            "                encode\n"
+            "                file writes what it receives to --sink from a thread of\n"
+            "                its own, dropping buffers instead of waiting for the\n"
+            "                disk, and -d file:PATH sets --sink too\n"
+            "  --sink=FILE   File for the file dest, or FILE.N for instance N\n"
+            "  --bitrate=BPS Bit rate of h264 and mjpeg (default: 17000000)\n"
+            "  --profile=PROFILE\n"
+            "                Profile of h264 (default: not set)\n"
+            "                Must be one of: baseline, main, high, constrained\n"
+            "  --intra=N     Intra period of h264 and mjpeg (default: not set)\n"
             "  -c CONN       Connection method to use (default: tunnel)\n"
             "                Must be one of: tunnel, callback, queue\n"
+            "  -z            Use zero copy buffers for callback and queue connections\n"
+            "  --workers=N   Pump threads of each queue connection (default: 1)\n"
+            "  -A CPU,...    Pin the pump threads to the CPUs in turn, given by\n"
+            "                number as in /proc/cpuinfo, e.g. -A cpu2,cpu3\n"
+            "  --fifo=PRIO   Run the pump threads with SCHED_FIFO priority PRIO\n"
+            "                (default: 0, for the default policy)\n"
+            "  --process=MODE[:USEC]\n"
+            "                Work on each buffer on the ARM side of callback and\n"
+            "                queue connections before passing it on (default: none)\n"
+            "                Must be one of: none, touch (a byte of every cache\n"
+            "                line), memcpy, histogram (of luma), busy:USEC\n"
+            "  -P PIPELINE   Chain of components to connect instead of -s SOURCE and\n"
+            "                -d DEST, e.g. source:isp@callback:resize:null@queue\n"
+            "                The first one is a source, the last one a dest and the\n"
+            "                ones in between are filters: isp, resize\n"
+            "                @CONN sets the method of the connection into the\n"
+            "                component; -c CONN is used for the others\n"
+            "                Callback and queue connections measure the latency from\n"
+            "                the PTS of the source too, so source:isp:render@callback\n"
+            "                -c tunnel gives the latency of the tunnelled part\n"
+            "  --instances=N Run N copies of the pipeline at the same time and report\n"
+            "                each of them and their sum (default: 1)\n"
+            "  --split=DEST[@CONN][+USEC],...\n"
+            "                Put vc.ril.video_splitter before the dest and connect\n"
+            "                it to each DEST too, up to 3 of them.  +USEC holds each\n"
+            "                buffer on the ARM side for USEC microseconds to make\n"
+            "                the branch a slow consumer\n"
+
+            "\n"
+            " Buffer options:\n"
+            "\n"
+            "  -b NUM        Number of buffers on the connection (default: recommended)\n"
+            "  -B SIZE       Size of a buffer in bytes (default: recommended)\n"
+            "  -S MAX        Run the benchmark for each buffer number from 1 to MAX\n"
+            "  --arena=ARENA,...\n"
+            "                Put the buffers of each callback and queue connection in\n"
+            "                one mapping instead of allocating each (default: none)\n"
+            "                Must be one of: none, anon, hugepage\n"
+            "                hugepage needs pages reserved in\n"
+            "                /proc/sys/vm/nr_hugepages; they cannot be used with -z\n"
+
+            "\n"
+            " Output options:\n"
+            "\n"
+            "  --repeat=N    Run each configuration N times and summarize them\n"
+            "                (default: 1)\n"
+            "  --reuse       Keep the connections across the trials and only enable\n"
+            "                and disable them in between\n"
+            "  --format=FMT  Format of the results (default: text)\n"
+            "                Must be one of: text, json, csv\n"
+            "                json and csv write one record per run to stdout\n"
+            "  --interval=MSEC\n"
+            "                Sample the stats every MSEC milliseconds during a run\n"
+            "  --samples=FILE\n"
+            "                Write the samples to FILE in the format above\n"
+            "                (default: stderr in text)\n"
+            "  --baseline=FILE\n"
+            "                Compare each configuration with its records in FILE,\n"
+            "                as --format=json wrote them, and exit with failure if\n"
+            "                frame/s, B/s or p99 latency regressed\n"
+            "  --threshold=PCT\n"
+            "                Regression in percent to fail at (default: 5)\n"
             );
 }
 
@@ -79,7 +169,7 @@ static int match_string_fuzzy(const char * const *array, int n,
     int index;
     int count;
 
-    for (index = 0; index < n; index ++) {
+    for (index = 0; n < 0 || index < n; index ++) {
         const char *item = array[index];
         if (item == NULL)
             break;
@@ -90,7 +180,7 @@ static int match_string_fuzzy(const char * const *array, int n,
     for (count = 1; ; count ++) {
         int matched_index;
         _Bool is_null_found = 0, is_matched = 0, is_ambiguous = 0;
-        for (index = 0; index < n; index ++) {
+        for (index = 0; n < 0 || index < n; index ++) {
             const char *item = array[index];
             if (item == NULL)
                 break;
@@ -114,137 +204,451 @@ static int match_string_fuzzy(const char * const *array, int n,
     return -ENOENT;
 }
 
-static void show_stats(const char * const name, MMAL_PORT_T * const port,
-        const double elapsed)
+/*
+ * Parses a comma-separated list of fuzzy-matched items of @table into @list.
+ * Exits on an unknown or ambiguous item.
+ * @what:  Name of the item for error messages
+ *
+ * Return: Number of items in @list.
+ */
+static int parse_list_table(const char * const what,
+        const char * const *table, const int n, const char *string,
+        int * const list)
 {
-    MMAL_PARAMETER_STATISTICS_T param = {
-        .hdr = {
-            .id = MMAL_PARAMETER_STATISTICS,
-            .size = sizeof(param),
-        },
-    };
+    char buf[256], *item, *saveptr;
+    int count = 0;
+
+    snprintf(buf, sizeof(buf), "%s", string);
+    for (item = strtok_r(buf, ",", &saveptr); item != NULL;
+            item = strtok_r(NULL, ",", &saveptr)) {
+        const int idx = match_string_fuzzy(table, n, item);
+        if (idx == -ENOTUNIQ) {
+            print_error("%s is ambiguous: %s\n", what, item);
+            exit(EXIT_FAILURE);
+        } else if (idx == -ENOENT) {
+            print_error("Unknown %s: %s\n", what, item);
+            exit(EXIT_FAILURE);
+        }
+        if (count == BENCH_LIST_MAX) {
+            print_error("Too many %s items: %s\n", what, string);
+            exit(EXIT_FAILURE);
+        }
+        list[count ++] = idx;
+    }
+    if (count == 0) {
+        print_error("Empty %s list\n", what);
+        exit(EXIT_FAILURE);
+    }
+    return count;
+}
+
+
+/*
+ * Parses -P into @stages and, in @conns, the connection method given with @
+ * on each stage, or -1 if not given.  Exits on a malformed pipeline.
+ *
+ * Return: Number of stages.
+ */
+static int parse_pipeline(const char *string,
+        struct bench_stage_config * const stages, int * const conns)
+{
+    char buf[256], *items[BENCH_STAGE_MAX], *item, *saveptr;
+    int count = 0, i;
+
+    snprintf(buf, sizeof(buf), "%s", string);
+    for (item = strtok_r(buf, ":", &saveptr); item != NULL;
+            item = strtok_r(NULL, ":", &saveptr)) {
+        if (count == BENCH_STAGE_MAX) {
+            print_error("Too many stages: %s\n", string);
+            exit(EXIT_FAILURE);
+        }
+        items[count ++] = item;
+    }
+    if (count < 2) {
+        print_error("Pipeline needs a source and a dest: %s\n", string);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < count; i ++) {
+        char * const at = strchr(items[i], '@');
+        int idx;
+
+        conns[i] = -1;
+        if (at != NULL) {
+            *at = '\0';
+            if (i == 0) {
+                print_error("Nothing is connected into the source: %s\n",
+                        string);
+                exit(EXIT_FAILURE);
+            }
+            idx = match_string_fuzzy(bench_conn_table, -1,
+                    at + 1);
+            if (idx < 0) {
+                print_error("Unknown or ambiguous conn: %s\n", at + 1);
+                exit(EXIT_FAILURE);
+            }
+            conns[i] = idx;
+        }
+        if (i == 0) {
+            stages[i].kind = BENCH_STAGE_SOURCE;
+            idx = match_string_fuzzy(bench_source_table,
+                    -1, items[i]);
+        } else if (i == count - 1) {
+            stages[i].kind = BENCH_STAGE_DEST;
+            idx = match_string_fuzzy(bench_dest_table, -1,
+                    items[i]);
+        } else {
+            stages[i].kind = BENCH_STAGE_FILTER;
+            idx = match_string_fuzzy(bench_filter_table,
+                    -1, items[i]);
+        }
+        if (idx == -ENOTUNIQ) {
+            print_error("Component is ambiguous: %s\n", items[i]);
+            exit(EXIT_FAILURE);
+        } else if (idx == -ENOENT) {
+            print_error("Unknown or misplaced component: %s\n", items[i]);
+            exit(EXIT_FAILURE);
+        }
+        stages[i].type = idx;
+    }
+    return count;
+}
+
+
+/*
+ * Parses --split into tmpl->branches.  Each item is DEST[@CONN][+USEC].
+ * Exits on a malformed item.
+ */
+static void parse_split(const char *string,
+        struct bench_graph_template * const tmpl)
+{
+    char buf[256], *item, *saveptr;
+
+    snprintf(buf, sizeof(buf), "%s", string);
+    tmpl->n_branches = 0;
+    for (item = strtok_r(buf, ",", &saveptr); item != NULL;
+            item = strtok_r(NULL, ",", &saveptr)) {
+        char * const plus = strchr(item, '+');
+        char *at;
+        int idx;
+
+        if (tmpl->n_branches == MMAL_COUNTOF(tmpl->branches)) {
+            print_error("Too many branches: %s\n", string);
+            exit(EXIT_FAILURE);
+        }
+        tmpl->branches[tmpl->n_branches].delay_usec = 0;
+        if (plus != NULL) {
+            *plus = '\0';
+            tmpl->branches[tmpl->n_branches].delay_usec = atoi(plus + 1);
+        }
+        tmpl->branches[tmpl->n_branches].conn = -1;
+        at = strchr(item, '@');
+        if (at != NULL) {
+            *at = '\0';
+            idx = match_string_fuzzy(bench_conn_table, -1,
+                    at + 1);
+            if (idx < 0) {
+                print_error("Unknown or ambiguous conn: %s\n", at + 1);
+                exit(EXIT_FAILURE);
+            }
+            tmpl->branches[tmpl->n_branches].conn = idx;
+        }
+        idx = match_string_fuzzy(bench_dest_table, -1, item);
+        if (idx == -ENOTUNIQ) {
+            print_error("Dest is ambiguous: %s\n", item);
+            exit(EXIT_FAILURE);
+        } else if (idx == -ENOENT) {
+            print_error("Unknown dest: %s\n", item);
+            exit(EXIT_FAILURE);
+        }
+        tmpl->branches[tmpl->n_branches ++].dest = (enum bench_dest) idx;
+    }
+    if (tmpl->n_branches == 0) {
+        print_error("Empty split list\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/* An item of -r */
+struct frame_size {
+    int width, height;
+};
 
-    check_mmal(mmal_port_parameter_get(port, &param.hdr));
 
-    print_info("%s: buffer_count: %u\n", name,  param.buffer_count);
-    print_info("%s: frame_count: %u\n", name, param.frame_count);
-    print_info("%s: frames_skipped: %u\n", name, param.frames_skipped);
-    print_info("%s: frames_discarded: %u\n", name, param.frames_discarded);
-    print_info("%s: total_bytes: %lld\n", name, param.total_bytes);
-    print_info("%s: %f [frame/s]\n", name, param.frame_count / elapsed);
-    print_info("%s: %e [B/s]\n", name, param.total_bytes / elapsed);
+/*
+ * Parses a comma-separated list of WIDTHxHEIGHT into @list.  Exits on a
+ * malformed item.
+ *
+ * Return: Number of items in @list.
+ */
+static int parse_list_size(const char *string, struct frame_size * const list)
+{
+    char buf[256], *item, *saveptr;
+    int count = 0;
+
+    snprintf(buf, sizeof(buf), "%s", string);
+    for (item = strtok_r(buf, ",", &saveptr); item != NULL;
+            item = strtok_r(NULL, ",", &saveptr)) {
+        if (count == BENCH_LIST_MAX) {
+            print_error("Too many resolution items: %s\n", string);
+            exit(EXIT_FAILURE);
+        }
+        if (sscanf(item, "%dx%d", &list[count].width, &list[count].height)
+                != 2 || list[count].width <= 0 || list[count].height <= 0) {
+            print_error("Resolution must be WIDTHxHEIGHT: %s\n", item);
+            exit(EXIT_FAILURE);
+        }
+        count ++;
+    }
+    if (count == 0) {
+        print_error("Empty resolution list\n");
+        exit(EXIT_FAILURE);
+    }
+    return count;
 }
 
+
+/* Return: @string as an int.  Exits if it is not a whole decimal int. */
+static int parse_int(const char * const what, const char * const string)
+{
+    char *end;
+    long v;
+
+    errno = 0;
+    v = strtol(string, &end, 10);
+    if (end == string || *end != '\0' || errno == ERANGE || v < INT_MIN
+            || v > INT_MAX) {
+        print_error("Invalid %s: %s\n", what, string);
+        exit(EXIT_FAILURE);
+    }
+    return v;
+}
+
+/*
+ * Integer version of parse_list_table().  Each item may start with @prefix,
+ * as cpu in cpu0, unless it is %NULL.  Exits on an item which is not a whole
+ * decimal int after that.
+ */
+static int parse_list_int(const char * const what, const char * const prefix,
+        const char *string, int * const list)
+{
+    char buf[256], *item, *saveptr;
+    int count = 0;
+
+    snprintf(buf, sizeof(buf), "%s", string);
+    for (item = strtok_r(buf, ",", &saveptr); item != NULL;
+            item = strtok_r(NULL, ",", &saveptr)) {
+        if (count == BENCH_LIST_MAX) {
+            print_error("Too many %s items: %s\n", what, string);
+            exit(EXIT_FAILURE);
+        }
+        if (prefix != NULL && strncmp(item, prefix, strlen(prefix)) == 0)
+            item += strlen(prefix);
+        list[count ++] = parse_int(what, item);
+    }
+    if (count == 0) {
+        print_error("Empty %s list\n", what);
+        exit(EXIT_FAILURE);
+    }
+    return count;
+}
+
+
+/*
+ * Return: Non-zero if the graph of @cfg can take -z and the delays of its
+ * hops, or 0 after saying that the cell is skipped and which hop it is for.
+ */
+static _Bool is_cell_runnable(const struct bench_config * const cfg)
+{
+    int i, n_tunnels = 0;
+
+    for (i = 0; i < cfg->n_hops; i ++) {
+        const struct bench_hop_config * const hop = &cfg->hops[i];
+        n_tunnels += hop->conn == BENCH_CONN_TUNNEL;
+        if (hop->delay_usec > 0 && hop->conn == BENCH_CONN_TUNNEL) {
+            print_error("Skipping %s with conn %s: hop %d, %s -> %s, is a "
+                    "%s, and a delay is only for callback and queue "
+                    "connections\n", bench_dest_table[cfg->dest],
+                    bench_conn_table[cfg->conn], i,
+                    bench_stage_name(&cfg->stages[hop->from]),
+                    bench_stage_name(&cfg->stages[hop->to]),
+                    bench_conn_table[hop->conn]);
+            return 0;
+        }
+    }
+    if (cfg->zero_copy && n_tunnels == cfg->n_hops) {
+        print_error("Skipping %s with conn %s: every hop is a tunnel, and "
+                "zero copy is only for callback and queue connections\n",
+                bench_dest_table[cfg->dest], bench_conn_table[cfg->conn]);
+        return 0;
+    }
+    return !0;
+}
+
+
 int main(int argc, char *argv[])
 {
     int opt, idx;
-    char fourcc[5];
-    MMAL_FOURCC_T encoding_mmal;
-    MMAL_SOURCE_PATTERN_T pattern_mmal;
-    int width = 1920, height = 1080;
-    int msec = 1000;
-    int camera_num = -1;
-    int source_output_port = 0;
-    MMAL_COMPONENT_T *cp_source, *cp_dest;
-    MMAL_CONNECTION_T *conn_source_dest;
-    double start, elapsed;
-
-    /* Encoding */
-    enum encoding {
-        ENCODING_I420 = 0, ENCODING_RGBA,
-    } encoding = ENCODING_I420;
-    const char* const encoding_table[] = {
-        "i420", "rgba", NULL
-    };
-    const MMAL_FOURCC_T const encoding_to_mmal[] = {
-        MMAL_ENCODING_I420, MMAL_ENCODING_RGBA,
+    struct bench_config cfg = {
+        .encoding = BENCH_ENCODING_I420,
+        .width = 1920,
+        .height = 1080,
+        .fps = 0,
+        .msec = 1000,
+        .frames = 0,
+        .warmup_msec = 0,
+        .source = BENCH_SOURCE_SOURCE,
+        .pattern = BENCH_PATTERN_WHITE,
+        .camera_num = -1,
+        .source_output_port = 0,
+        .dest = BENCH_DEST_NULL,
+        .conn = BENCH_CONN_TUNNEL,
+        .zero_copy = 0,
+        .buffer_num = 0,
+        .buffer_size = 0,
+        .workers = 1,
+        .n_cpus = 0,
+        .fifo_priority = 0,
+        .reuse = 0,
+        .process = BENCH_PROCESS_NONE,
+        .process_arg = 0,
+        .arena = BENCH_ARENA_NONE,
+        .bitrate = 17000000,
+        .profile = -1,
+        .intra_period = 0,
+        .codec = BENCH_CODEC_H264,
+        .stream_path = NULL,
+        .stream = NULL,
+        .stream_size = 0,
+        .sink_path = NULL,
     };
-    /* Source */
-    enum source {
-        SOURCE_SOURCE = 0, SOURCE_CAMERA,
-    } source = SOURCE_SOURCE;
-    const char* const source_table[] = {
-        "source", "camera", NULL
+    /* Matrix of the configurations to run; one item each by default. */
+    int encodings[BENCH_LIST_MAX] = {BENCH_ENCODING_I420}, n_encodings = 1;
+    int widths[BENCH_LIST_MAX] = {1920}, n_widths = 1;
+    int heights[BENCH_LIST_MAX] = {1080}, n_heights = 1;
+    int dests[BENCH_LIST_MAX] = {BENCH_DEST_NULL}, n_dests = 1;
+    int conns[BENCH_LIST_MAX] = {BENCH_CONN_TUNNEL}, n_conns = 1;
+    int arenas[BENCH_LIST_MAX] = {BENCH_ARENA_NONE}, n_arenas = 1;
+    /* -r, or every combination of -w and -h */
+    struct frame_size sizes[BENCH_LIST_MAX * BENCH_LIST_MAX];
+    int n_sizes = 0;
+    int i_encoding, i_size, i_dest, i_conn, i_arena, i;
+    struct bench_graph_template tmpl = {
+        .n_stages = 0,
+        .n_branches = 0,
     };
-    const char* const source_to_mmal[] = {
-        "vc.ril.source", "vc.ril.camera",
+    _Bool is_source_given = 0, is_dest_given = 0, is_size_given = 0;
+    _Bool is_msec_given = 0;
+    struct bench_pipeline *pipeline;
+    int failed = 0;
+    struct bench_run_options opts = {
+        .sweep_max = 0,
+        .repeat = 1,
+        .format = BENCH_FORMAT_TEXT,
+        .interval_msec = 0,
+        .samples_fp = NULL,
+        .instances = 1,
+        .n_camera_nums = 0,
+        .baseline = NULL,
     };
-    /* Pattern */
-    enum pattern {
-        PATTERN_WHITE = 0, PATTERN_BLACK, PATTERN_DIAGONAL, PATTERN_NOISE,
-        PATTERN_RANDOM, PATTERN_COLOUR, PATTERN_BLOCKS, PATTERN_SWIRLY,
-    } pattern = PATTERN_WHITE;
-    const char* const pattern_table[] = {
-        "white", "black", "diagonal", "noise", "random", "colour", "blocks",
-        "swirly", NULL
+    const char *samples_path = NULL;
+    const char *baseline_path = NULL;
+    /* Regressions from the baseline of more than this [%] fail */
+    double threshold = 5;
+    _Bool is_threshold_given = 0;
+    struct bench_baseline baseline = {
+        .records = NULL,
+        .n = 0,
+        .n_failed = 0,
     };
-    const MMAL_SOURCE_PATTERN_T const pattern_to_mmal[] = {
-        MMAL_VIDEO_SOURCE_PATTERN_WHITE,
-        MMAL_VIDEO_SOURCE_PATTERN_BLACK,
-        MMAL_VIDEO_SOURCE_PATTERN_DIAGONAL,
-        MMAL_VIDEO_SOURCE_PATTERN_NOISE,
-        MMAL_VIDEO_SOURCE_PATTERN_RANDOM,
-        MMAL_VIDEO_SOURCE_PATTERN_COLOUR,
-        MMAL_VIDEO_SOURCE_PATTERN_BLOCKS,
-        MMAL_VIDEO_SOURCE_PATTERN_SWIRLY,
+    enum {
+        OPT_FORMAT = 0x100, OPT_WARMUP, OPT_REPEAT, OPT_INTERVAL,
+        OPT_SAMPLES, OPT_SPLIT, OPT_INSTANCES, OPT_WORKERS, OPT_FIFO,
+        OPT_PROCESS, OPT_REUSE, OPT_BITRATE, OPT_PROFILE, OPT_INTRA,
+        OPT_STREAM, OPT_CODEC, OPT_SINK, OPT_ARENA, OPT_BASELINE,
+        OPT_THRESHOLD,
     };
-    /* Dest */
-    enum dest {
-        DEST_NULL = 0, DEST_RENDER,
-    } dest = DEST_NULL;
-    const char* const dest_table[] = {
-        "null", "render", NULL
-    };
-    const char* const dest_to_mmal[] = {
-        "vc.null_sink", "vc.ril.video_render",
-    };
-    /* Conn */
-    enum conn {
-        CONN_TUNNEL = 0, CONN_CALLBACK, CONN_QUEUE,
-    } conn = CONN_TUNNEL;
-    const char* const conn_table[] = {
-        "tunnel", "callback", "queue", NULL
+    static const struct option long_options[] = {
+        {"format", required_argument, NULL, OPT_FORMAT},
+        {"warmup", required_argument, NULL, OPT_WARMUP},
+        {"repeat", required_argument, NULL, OPT_REPEAT},
+        {"interval", required_argument, NULL, OPT_INTERVAL},
+        {"samples", required_argument, NULL, OPT_SAMPLES},
+        {"split", required_argument, NULL, OPT_SPLIT},
+        {"instances", required_argument, NULL, OPT_INSTANCES},
+        {"workers", required_argument, NULL, OPT_WORKERS},
+        {"fifo", required_argument, NULL, OPT_FIFO},
+        {"process", required_argument, NULL, OPT_PROCESS},
+        {"reuse", no_argument, NULL, OPT_REUSE},
+        {"bitrate", required_argument, NULL, OPT_BITRATE},
+        {"profile", required_argument, NULL, OPT_PROFILE},
+        {"intra", required_argument, NULL, OPT_INTRA},
+        {"stream", required_argument, NULL, OPT_STREAM},
+        {"codec", required_argument, NULL, OPT_CODEC},
+        {"sink", required_argument, NULL, OPT_SINK},
+        {"arena", required_argument, NULL, OPT_ARENA},
+        {"baseline", required_argument, NULL, OPT_BASELINE},
+        {"threshold", required_argument, NULL, OPT_THRESHOLD},
+        {NULL, 0, NULL, 0},
     };
 
     progname = argv[0];
-    while ((opt = getopt(argc, argv, "e:w:h:t:s:p:n:o:d:c:?")) != -1) {
+    if (bench_pipeline_init())
+        exit(EXIT_FAILURE);
+    while ((opt = getopt_long(argc, argv, "e:w:h:r:f:t:N:s:p:n:o:d:c:zP:b:B:S:A:?",
+                    long_options, NULL)) != -1) {
         switch (opt) {
             case 'e':
-                idx = match_string_fuzzy(encoding_table,
-                        MMAL_COUNTOF(encoding_table), optarg);
-                if (idx == -ENOTUNIQ) {
-                    print_error("Encoding is ambiguous: %s\n", optarg);
-                    exit(EXIT_FAILURE);
-                } else if (idx == -ENOENT) {
-                    print_error("Unknown encoding: %s\n", optarg);
-                    exit(EXIT_FAILURE);
-                }
-                encoding = (enum encoding) idx;
+                n_encodings = parse_list_table("encoding", bench_encoding_table,
+                        -1, optarg, encodings);
                 break;
             case 'w':
-                width = atoi(optarg);
+                n_widths = parse_list_int("width", NULL, optarg, widths);
+                is_size_given = !0;
                 break;
             case 'h':
-                height = atoi(optarg);
+                n_heights = parse_list_int("height", NULL, optarg, heights);
+                is_size_given = !0;
+                break;
+            case 'r':
+                n_sizes = parse_list_size(optarg, sizes);
+                break;
+            case 'f':
+                cfg.fps = atof(optarg);
                 break;
             case 't':
-                msec = atoi(optarg);
+                cfg.msec = atoi(optarg);
+                is_msec_given = !0;
+                break;
+            case 'N':
+                cfg.frames = atoi(optarg);
                 break;
             case 's':
-                idx = match_string_fuzzy(source_table,
-                        MMAL_COUNTOF(source_table), optarg);
-                if (idx == -ENOTUNIQ) {
-                    print_error("Source is ambiguous: %s\n", optarg);
-                    exit(EXIT_FAILURE);
-                } else if (idx == -ENOENT) {
-                    print_error("Unknown source: %s\n", optarg);
-                    exit(EXIT_FAILURE);
+                {
+                    /* file:PATH is file --stream=PATH. */
+                    char buf[64], * const colon = strchr(optarg, ':');
+                    snprintf(buf, sizeof(buf), "%s", optarg);
+                    if (colon != NULL) {
+                        buf[MMAL_MIN((size_t) (colon - optarg),
+                                sizeof(buf) - 1)] = '\0';
+                        cfg.stream_path = colon + 1;
+                    }
+                    idx = match_string_fuzzy(bench_source_table,
+                            -1, buf);
+                    if (idx == -ENOTUNIQ) {
+                        print_error("Source is ambiguous: %s\n", buf);
+                        exit(EXIT_FAILURE);
+                    } else if (idx == -ENOENT) {
+                        print_error("Unknown source: %s\n", buf);
+                        exit(EXIT_FAILURE);
+                    }
+                    cfg.source = (enum bench_source) idx;
+                    is_source_given = !0;
                 }
-                source = (enum source) idx;
                 break;
             case 'p':
-                idx = match_string_fuzzy(pattern_table,
-                        MMAL_COUNTOF(pattern_table), optarg);
+                idx = match_string_fuzzy(bench_pattern_table,
+                        -1, optarg);
                 if (idx == -ENOTUNIQ) {
                     print_error("Pattern is ambiguous: %s\n", optarg);
                     exit(EXIT_FAILURE);
@@ -252,37 +656,160 @@ int main(int argc, char *argv[])
                     print_error("Unknown pattern: %s\n", optarg);
                     exit(EXIT_FAILURE);
                 }
-                pattern = (enum pattern) idx;
+                cfg.pattern = (enum bench_pattern) idx;
                 break;
             case 'n':
-                camera_num = atoi(optarg);
+                opts.n_camera_nums = parse_list_int("camera_num", NULL, optarg,
+                        opts.camera_nums);
+                cfg.camera_num = opts.camera_nums[0];
                 break;
             case 'o':
-                source_output_port = atoi(optarg);
+                cfg.source_output_port = atoi(optarg);
                 break;
             case 'd':
-                idx = match_string_fuzzy(dest_table,
-                        MMAL_COUNTOF(dest_table), optarg);
+                {
+                    /* file:PATH is file --sink=PATH, and comes last. */
+                    char buf[256], * const colon = strchr(optarg, ':');
+                    snprintf(buf, sizeof(buf), "%s", optarg);
+                    if (colon != NULL) {
+                        buf[MMAL_MIN((size_t) (colon - optarg),
+                                sizeof(buf) - 1)] = '\0';
+                        cfg.sink_path = colon + 1;
+                    }
+                    n_dests = parse_list_table("dest", bench_dest_table,
+                            -1, buf, dests);
+                    is_dest_given = !0;
+                }
+                break;
+            case 'c':
+                n_conns = parse_list_table("conn", bench_conn_table,
+                        -1, optarg, conns);
+                break;
+            case 'z':
+                cfg.zero_copy = !0;
+                break;
+            case 'P':
+                tmpl.n_stages = parse_pipeline(optarg, tmpl.stages,
+                        tmpl.conns);
+                break;
+            case 'b':
+                cfg.buffer_num = atoi(optarg);
+                break;
+            case 'B':
+                cfg.buffer_size = atoi(optarg);
+                break;
+            case 'S':
+                opts.sweep_max = atoi(optarg);
+                break;
+            case OPT_FORMAT:
+                idx = match_string_fuzzy(bench_format_table,
+                        -1, optarg);
                 if (idx == -ENOTUNIQ) {
-                    print_error("Dest is ambiguous: %s\n", optarg);
+                    print_error("Format is ambiguous: %s\n", optarg);
                     exit(EXIT_FAILURE);
                 } else if (idx == -ENOENT) {
-                    print_error("Unknown dest: %s\n", optarg);
+                    print_error("Unknown format: %s\n", optarg);
                     exit(EXIT_FAILURE);
                 }
-                dest = (enum dest) idx;
+                opts.format = (enum bench_format) idx;
                 break;
-            case 'c':
-                idx = match_string_fuzzy(conn_table,
-                        MMAL_COUNTOF(conn_table), optarg);
+            case OPT_WARMUP:
+                cfg.warmup_msec = atoi(optarg);
+                break;
+            case OPT_REPEAT:
+                opts.repeat = atoi(optarg);
+                break;
+            case OPT_INTERVAL:
+                opts.interval_msec = atoi(optarg);
+                break;
+            case OPT_SAMPLES:
+                samples_path = optarg;
+                break;
+            case OPT_SPLIT:
+                parse_split(optarg, &tmpl);
+                break;
+            case OPT_INSTANCES:
+                opts.instances = atoi(optarg);
+                break;
+            case OPT_WORKERS:
+                cfg.workers = atoi(optarg);
+                break;
+            case 'A':
+                cfg.n_cpus = parse_list_int("cpu", "cpu", optarg, cfg.cpus);
+                break;
+            case OPT_FIFO:
+                cfg.fifo_priority = parse_int("SCHED_FIFO priority", optarg);
+                break;
+            case OPT_REUSE:
+                cfg.reuse = !0;
+                break;
+            case OPT_BITRATE:
+                cfg.bitrate = atoi(optarg);
+                break;
+            case OPT_PROFILE:
+                idx = match_string_fuzzy(bench_profile_table,
+                        -1, optarg);
+                if (idx == -ENOTUNIQ) {
+                    print_error("Profile is ambiguous: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                } else if (idx == -ENOENT) {
+                    print_error("Unknown profile: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                cfg.profile = idx;
+                break;
+            case OPT_INTRA:
+                cfg.intra_period = atoi(optarg);
+                break;
+            case OPT_STREAM:
+                cfg.stream_path = optarg;
+                break;
+            case OPT_ARENA:
+                n_arenas = parse_list_table("arena", bench_arena_table,
+                        -1, optarg, arenas);
+                break;
+            case OPT_SINK:
+                cfg.sink_path = optarg;
+                break;
+            case OPT_BASELINE:
+                baseline_path = optarg;
+                break;
+            case OPT_THRESHOLD:
+                threshold = atof(optarg);
+                is_threshold_given = !0;
+                break;
+            case OPT_CODEC:
+                idx = match_string_fuzzy(bench_codec_table,
+                        -1, optarg);
                 if (idx == -ENOTUNIQ) {
-                    print_error("Conn is ambiguous: %s\n", optarg);
+                    print_error("Codec is ambiguous: %s\n", optarg);
                     exit(EXIT_FAILURE);
                 } else if (idx == -ENOENT) {
-                    print_error("Unknown conn: %s\n", optarg);
+                    print_error("Unknown codec: %s\n", optarg);
                     exit(EXIT_FAILURE);
                 }
-                conn = (enum conn) idx;
+                cfg.codec = (enum bench_codec) idx;
+                break;
+            case OPT_PROCESS:
+                {
+                    char buf[64], * const colon = strchr(optarg, ':');
+                    snprintf(buf, sizeof(buf), "%s", optarg);
+                    if (colon != NULL) {
+                        buf[MMAL_MIN((size_t) (colon - optarg),
+                                sizeof(buf) - 1)] = '\0';
+                        cfg.process_arg = atoi(colon + 1);
+                    }
+                    idx = match_string_fuzzy(bench_process_table,
+                            -1, buf);
+                    if (idx == -ENOTUNIQ) {
+                        print_error("Process is ambiguous: %s\n", buf);
+                        exit(EXIT_FAILURE);
+                    } else if (idx == -ENOENT) {
+                        print_error("Unknown process: %s\n", buf);
+                        exit(EXIT_FAILURE);
+                    }
+                    cfg.process = (enum bench_process) idx;
+                }
                 break;
             case '?':
                 usage();
@@ -297,120 +824,188 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
-    encoding_mmal = encoding_to_mmal[encoding];
-    pattern_mmal = pattern_to_mmal[pattern];
-
-    print_info("encoding: %s (%s)\n", encoding_table[encoding],
-            mmal_4cc_to_string(fourcc, sizeof(fourcc), encoding_mmal));
-    print_info("width: %d\n", width);
-    print_info("height: %d\n", height);
-    print_info("msec: %d\n", msec);
-    print_info("source: %s (%s)\n", source_table[source],
-            source_to_mmal[source]);
-    print_info("pattern: %s\n", pattern_table[pattern]);
-    print_info("camera_num: %d\n", camera_num);
-    print_info("source_output_port: %d\n", source_output_port);
-    print_info("dest: %s (%s)\n", dest_table[dest], dest_to_mmal[dest]);
-    print_info("conn: %s\n", conn_table[conn]);
-
-    if (source == SOURCE_SOURCE && source_output_port != 0) {
-        print_error("Output port must be 0 for source source\n");
+    print_info("sweep_max: %u\n", opts.sweep_max);
+    print_info("repeat: %u\n", opts.repeat);
+    print_info("instances: %d\n", opts.instances);
+    print_info("format: %s\n", bench_format_table[opts.format]);
+    print_info("interval_msec: %d\n", opts.interval_msec);
+    print_info("samples: %s\n", samples_path == NULL ? "-" : samples_path);
+    print_info("baseline: %s\n", baseline_path == NULL ? "-" : baseline_path);
+    print_info("threshold: %f\n", threshold);
+
+    if (n_sizes != 0 && is_size_given) {
+        print_error("-r and -w or -h are exclusive\n");
         exit(EXIT_FAILURE);
     }
-
-    {
-        const char * const name = source_to_mmal[source];
-        check_mmal(mmal_component_create(name, &cp_source));
-        {
-            MMAL_PORT_T *port = mmal_util_get_port(cp_source,
-                    MMAL_PORT_TYPE_CONTROL, 0);
-            check_mmal(mmal_port_enable(port, cb_control));
+    if (n_sizes == 0)
+        for (i = 0; i < n_widths * n_heights; i ++)
+            sizes[n_sizes ++] = (struct frame_size) {
+                widths[i / n_heights], heights[i % n_heights]
+            };
+    if (tmpl.n_stages != 0 && (is_source_given || is_dest_given)) {
+        print_error("-P and -s or -d are exclusive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (tmpl.n_stages != 0) {
+        cfg.source = (enum bench_source) tmpl.stages[0].type;
+        dests[0] = tmpl.stages[tmpl.n_stages - 1].type;
+    }
+    if (tmpl.n_branches != 0 && (tmpl.n_stages == 0 ? 2 : tmpl.n_stages)
+            + 1 + tmpl.n_branches > BENCH_STAGE_MAX) {
+        print_error("Too many stages with the splitter and the branches\n");
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.source != BENCH_SOURCE_CAMERA && cfg.source_output_port != 0) {
+        print_error("Output port must be 0 for %s source\n",
+                bench_source_table[cfg.source]);
+        exit(EXIT_FAILURE);
+    }
+    if ((cfg.source == BENCH_SOURCE_DECODE || cfg.source == BENCH_SOURCE_FILE)
+            != (cfg.stream_path != NULL)) {
+        print_error("--stream is for and is needed by the decode and file "
+                "sources\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < n_dests && dests[i] != BENCH_DEST_FILE; i ++)
+        ;
+    if ((i < n_dests) != (cfg.sink_path != NULL)) {
+        print_error("--sink is for and is needed by the file dest\n");
+        exit(EXIT_FAILURE);
+    }
+    /* Without a stage in between, there is nothing for the files to feed. */
+    if (cfg.source == BENCH_SOURCE_FILE && tmpl.n_branches == 0
+            && tmpl.n_stages <= 2 && i < n_dests) {
+        print_error("The file source cannot go straight into the file "
+                "dest\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < tmpl.n_branches; i ++) {
+        if (tmpl.branches[i].dest == BENCH_DEST_FILE) {
+            print_error("The file dest cannot be a branch of --split\n");
+            exit(EXIT_FAILURE);
         }
-        {
-            MMAL_PORT_T *port = mmal_util_get_port(cp_source,
-                    MMAL_PORT_TYPE_OUTPUT, source_output_port);
-            switch (source) {
-                case SOURCE_SOURCE:
-                    {
-                        MMAL_PARAMETER_VIDEO_SOURCE_PATTERN_T param = {
-                            .hdr = {
-                                .id = MMAL_PARAMETER_VIDEO_SOURCE_PATTERN,
-                                .size = sizeof(param),
-                            },
-                            .pattern = pattern_mmal,
-                        };
-                        check_mmal(mmal_port_parameter_set(port, &param.hdr));
-                    }
-                    break;
-                case SOURCE_CAMERA:
-                    {
-                        if (camera_num >= 0) {
-                            print_info("Setting camera_num to %d\n",
-                                    camera_num);
-                            check_mmal(mmal_port_parameter_set_int32(
-                                        cp_source->control,
-                                        MMAL_PARAMETER_CAMERA_NUM, camera_num));
-                        }
-                    }
-                    break;
-            }
-            config_port(port, encoding_mmal, width, height);
+    }
+    for (i = 0; i < n_encodings; i ++) {
+        if (cfg.source == BENCH_SOURCE_FILE
+                && encodings[i] == BENCH_ENCODING_OPAQUE) {
+            print_error("Opaque frames cannot be fed from a file\n");
+            exit(EXIT_FAILURE);
         }
-        check_mmal(mmal_component_enable(cp_source));
     }
-
-    {
-        const char * const name = dest_to_mmal[dest];
-        check_mmal(mmal_component_create(name, &cp_dest));
-        {
-            MMAL_PORT_T *port = mmal_util_get_port(cp_dest,
-                    MMAL_PORT_TYPE_CONTROL, 0);
-            check_mmal(mmal_port_enable(port, cb_control));
+    if (cfg.stream_path != NULL && bench_map_stream(&cfg))
+        exit(EXIT_FAILURE);
+    if (opts.instances < 1 || opts.instances > BENCH_INSTANCE_MAX) {
+        print_error("Instances must be from 1 to %d\n", BENCH_INSTANCE_MAX);
+        exit(EXIT_FAILURE);
+    }
+    if (opts.n_camera_nums > 1 && opts.n_camera_nums != opts.instances) {
+        print_error("-n must give one camera or one per instance\n");
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.workers < 1 || cfg.workers > BENCH_WORKER_MAX) {
+        print_error("Workers must be from 1 to %d\n", BENCH_WORKER_MAX);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < cfg.n_cpus; i ++) {
+        if (cfg.cpus[i] < 0 || cfg.cpus[i] >= CPU_SETSIZE) {
+            print_error("Invalid CPU: %d\n", cfg.cpus[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (cfg.fifo_priority < 0 || cfg.fifo_priority
+            > sched_get_priority_max(SCHED_FIFO)) {
+        print_error("SCHED_FIFO priority must be from 0 (off) to %d\n",
+                sched_get_priority_max(SCHED_FIFO));
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.process == BENCH_PROCESS_BUSY && cfg.process_arg <= 0) {
+        print_error("--process=busy needs :USEC\n");
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.frames < 0) {
+        print_error("Frames must be >= 0\n");
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.frames != 0 && !is_msec_given)
+        cfg.msec = BENCH_FRAMES_TIMEOUT_MSEC;
+    if (opts.repeat < 1) {
+        print_error("Repeat must be >= 1\n");
+        exit(EXIT_FAILURE);
+    }
+    if (opts.sweep_max != 0 && cfg.buffer_num != 0) {
+        print_error("-b and -S are exclusive\n");
+        exit(EXIT_FAILURE);
+    }
+    if (samples_path != NULL) {
+        if (opts.interval_msec <= 0) {
+            print_error("--samples needs --interval\n");
+            exit(EXIT_FAILURE);
         }
-        {
-            MMAL_PORT_T *port = mmal_util_get_port(cp_dest,
-                    MMAL_PORT_TYPE_INPUT, 0);
-            config_port(port, encoding_mmal, width, height);
+        opts.samples_fp = fopen(samples_path, "w");
+        if (opts.samples_fp == NULL) {
+            print_error("Failed to open %s: %s\n", samples_path,
+                    strerror(errno));
+            exit(EXIT_FAILURE);
         }
-        check_mmal(mmal_component_enable(cp_dest));
-    }
-
-    check_mmal(mmal_connection_create(&conn_source_dest,
-            cp_source->output[source_output_port], cp_dest->input[0],
-            MMAL_CONNECTION_FLAG_TUNNELLING));
-    conn_source_dest->callback = cb_conn;
-
-    check_mmal(mmal_connection_enable(conn_source_dest));
-    if (source == SOURCE_CAMERA
-            && (source_output_port == 1 || source_output_port == 2)) {
-        print_info("Setting capture to true\n");
-        check_mmal(mmal_port_parameter_set_boolean(
-                cp_source->output[source_output_port],
-                MMAL_PARAMETER_CAPTURE, MMAL_TRUE));
-    }
-    print_info("Sleeping for %d milliseconds\n", msec);
-    start = get_time();
-    {
-        struct timespec t = {
-            .tv_sec = msec * 1e-3,
-            .tv_nsec = (msec % 1000) * 1e6,
-        };
-        (void) nanosleep(&t, NULL);
-    }
-    check_mmal(mmal_connection_disable(conn_source_dest));
-    elapsed = get_time() - start;
+    }
+    if (is_threshold_given && baseline_path == NULL) {
+        print_error("--threshold needs --baseline\n");
+        exit(EXIT_FAILURE);
+    }
+    if (threshold < 0) {
+        print_error("Threshold must be >= 0\n");
+        exit(EXIT_FAILURE);
+    }
+    if (baseline_path != NULL) {
+        if (bench_load_baseline(baseline_path, &baseline))
+            exit(EXIT_FAILURE);
+        baseline.threshold = threshold * 1e-2;
+        opts.baseline = &baseline;
+    }
+    for (i = 0; i < n_arenas; i ++) {
+        /* Zero copy payloads must be in memory shared with VideoCore. */
+        if (cfg.zero_copy && arenas[i] != BENCH_ARENA_NONE) {
+            print_error("--arena is for connections without zero copy\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
+    pipeline = bench_pipeline_create();
+    if (pipeline == NULL)
+        exit(EXIT_FAILURE);
     /*
-     * Only vc.ril.source and vc.ril.video_render have an ability to query
-     * stats here.  Note that the latter always sets total_bytes to 0.
+     * Dest is the outermost loop as it is the only one that needs the
+     * components to be recreated.
      */
-    if (source == SOURCE_SOURCE)
-        show_stats("source", cp_source->output[source_output_port], elapsed);
-    if (dest == DEST_RENDER)
-        show_stats("dest", cp_dest->input[0], elapsed);
-
-    check_mmal(mmal_connection_destroy(conn_source_dest));
-    check_mmal(mmal_component_destroy(cp_dest));
-    check_mmal(mmal_component_destroy(cp_source));
-    return 0;
+    for (i_dest = 0; i_dest < n_dests; i_dest ++)
+    for (i_conn = 0; i_conn < n_conns; i_conn ++)
+    for (i_arena = 0; i_arena < n_arenas; i_arena ++)
+    for (i_encoding = 0; i_encoding < n_encodings; i_encoding ++)
+    for (i_size = 0; i_size < n_sizes; i_size ++) {
+        cfg.dest = (enum bench_dest) dests[i_dest];
+        cfg.conn = (enum bench_conn) conns[i_conn];
+        cfg.arena = (enum bench_arena) arenas[i_arena];
+        cfg.encoding = (enum bench_encoding) encodings[i_encoding];
+        cfg.width = sizes[i_size].width;
+        cfg.height = sizes[i_size].height;
+        bench_build_graph(&cfg, &tmpl);
+        if (!is_cell_runnable(&cfg))
+            continue;
+        if (bench_pipeline_run_cell(pipeline, &cfg, &opts)) {
+            print_error("Failed to run the configuration above\n");
+            failed = !0;
+        }
+    }
+    bench_pipeline_destroy(pipeline);
+    if (opts.samples_fp != NULL)
+        fclose(opts.samples_fp);
+    if (opts.baseline != NULL) {
+        bench_free_baseline(&baseline);
+        if (baseline.n_failed != 0) {
+            print_error("%u configuration(s) regressed from %s or are not "
+                    "in it\n", baseline.n_failed, baseline_path);
+            failed = !0;
+        }
+    }
+    return failed ? EXIT_FAILURE : 0;
 }
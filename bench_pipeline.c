@@ -0,0 +1,4673 @@
+/*
+ * Copyright (c) 2018 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/* For CPU_SET and pthread_setaffinity_np */
+#define _GNU_SOURCE
+
+#include <interface/mmal/mmal.h>
+#include <interface/mmal/util/mmal_connection.h>
+#include <interface/mmal/util/mmal_util.h>
+#include <interface/mmal/util/mmal_util_params.h>
+#include <interface/vcos/vcos.h>
+#include <interface/vmcs_host/vc_gencmd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+
+#include "common.h"
+#include "bench_pipeline.h"
+
+/* Names of the enums of bench_pipeline.h, and what they are in MMAL */
+const char * const bench_encoding_table[] = {
+    "i420", "rgba", "opaque", "rgb24", "bgr24", "yuyv", "nv12", NULL
+};
+static const MMAL_FOURCC_T encoding_to_mmal[] = {
+    MMAL_ENCODING_I420, MMAL_ENCODING_RGBA, MMAL_ENCODING_OPAQUE,
+    MMAL_ENCODING_RGB24, MMAL_ENCODING_BGR24, MMAL_ENCODING_YUYV,
+    MMAL_ENCODING_NV12,
+};
+const char * const bench_source_table[] = {
+    "source", "camera", "decode", "file", NULL
+};
+/* BENCH_SOURCE_FILE has no component; the ARM side feeds the next stage. */
+static const char * const source_to_mmal[] = {
+    "vc.ril.source", "vc.ril.camera", "vc.ril.video_decode", "-",
+};
+const char * const bench_codec_table[] = {
+    "h264", "mjpeg", NULL
+};
+static const MMAL_FOURCC_T codec_to_mmal[] = {
+    MMAL_ENCODING_H264, MMAL_ENCODING_MJPEG,
+};
+const char * const bench_pattern_table[] = {
+    "white", "black", "diagonal", "noise", "random", "colour", "blocks",
+    "swirly", NULL
+};
+static const MMAL_SOURCE_PATTERN_T pattern_to_mmal[] = {
+    MMAL_VIDEO_SOURCE_PATTERN_WHITE,
+    MMAL_VIDEO_SOURCE_PATTERN_BLACK,
+    MMAL_VIDEO_SOURCE_PATTERN_DIAGONAL,
+    MMAL_VIDEO_SOURCE_PATTERN_NOISE,
+    MMAL_VIDEO_SOURCE_PATTERN_RANDOM,
+    MMAL_VIDEO_SOURCE_PATTERN_COLOUR,
+    MMAL_VIDEO_SOURCE_PATTERN_BLOCKS,
+    MMAL_VIDEO_SOURCE_PATTERN_SWIRLY,
+};
+const char * const bench_filter_table[] = {
+    "isp", "resize", "splitter", NULL
+};
+static const char * const filter_to_mmal[] = {
+    "vc.ril.isp", "vc.ril.resize", "vc.ril.video_splitter",
+};
+const char * const bench_dest_table[] = {
+    "null", "render", "h264", "mjpeg", "jpeg", "file", NULL
+};
+/* BENCH_DEST_FILE has no component; the ARM side drains the previous stage. */
+static const char * const dest_to_mmal[] = {
+    "vc.null_sink", "vc.ril.video_render", "vc.ril.video_encode",
+    "vc.ril.video_encode", "vc.ril.image_encode", "-",
+};
+/* Encoding of the output of the encoder dests, or 0 for the others */
+static const MMAL_FOURCC_T dest_to_encoding[] = {
+    0, 0, MMAL_ENCODING_H264, MMAL_ENCODING_MJPEG, MMAL_ENCODING_JPEG, 0,
+};
+const char * const bench_profile_table[] = {
+    "baseline", "main", "high", "constrained", NULL
+};
+static const MMAL_VIDEO_PROFILE_T profile_to_mmal[] = {
+    MMAL_VIDEO_PROFILE_H264_BASELINE, MMAL_VIDEO_PROFILE_H264_MAIN,
+    MMAL_VIDEO_PROFILE_H264_HIGH, MMAL_VIDEO_PROFILE_H264_CONSTRAINED_BASELINE,
+};
+const char * const bench_conn_table[] = {
+    "tunnel", "callback", "queue", NULL
+};
+
+const char * const bench_process_table[] = {
+    "none", "touch", "memcpy", "histogram", "busy", NULL
+};
+
+const char * const bench_arena_table[] = {
+    "none", "anon", "hugepage", NULL
+};
+
+const char * const bench_format_table[] = {
+    "text", "json", "csv", NULL
+};
+
+/* Buffers a file dest can hold while they are being written */
+#define WRITER_SLOTS 8
+
+/* A pump thread of a BENCH_CONN_QUEUE connection */
+struct worker {
+    MMAL_CONNECTION_T *conn;
+    VCOS_THREAD_T thread;
+    /* -1 to leave it to the scheduler */
+    int cpu;
+    /* 0 for the default policy */
+    int fifo_priority;
+};
+
+/*
+ * State of a non-tunnelled connection, hung off MMAL_CONNECTION_T::user_data.
+ * @lock serialises buffer forwarding between the MMAL callback threads, the
+ * pump thread and the thread running the bench; @running is cleared under it
+ * before the connection is disabled so that no buffer is sent to a port that
+ * is going away.
+ */
+struct conn_ctx {
+    enum bench_conn conn;
+    int delay_usec;
+    enum bench_process process;
+    int process_arg;
+    /*
+     * Destination of BENCH_PROCESS_MEMCPY, of @scratch_size bytes, at least
+     * the buffer size of the output port
+     */
+    void *scratch;
+    size_t scratch_size;
+    /*
+     * Times between buffers coming out of the output port, whose deviation
+     * is the jitter of the frame rate; @last_arrival is 0 until the first.
+     */
+    double last_arrival;
+    struct bench_hist interval;
+    /* When the first buffer came out after bench_start(), or 0 */
+    double first_arrival;
+    /*
+     * get_time() minus the VideoCore STC [s] to map the PTS stamped at the
+     * source onto the ARM clock, or 0 if the STC cannot be read.  The time
+     * from the PTS to the arrival here is the latency of everything
+     * upstream, tunnels included; arrivals which do not map to a sane
+     * latency, as with PTS which are not on the STC, are counted apart.
+     */
+    double stc_offset;
+    struct bench_hist pts_latency;
+    unsigned pts_unmapped;
+    /*
+     * Results of BENCH_PROCESS_TOUCH and BENCH_PROCESS_HISTOGRAM, so they are
+     * not elided
+     */
+    unsigned char touched;
+    unsigned histogram[256];
+    /* Time spent in process_buffer() in seconds */
+    double process_time;
+    VCOS_MUTEX_T lock;
+    _Bool running;
+    /* Set while conn_event() applies a format change with @lock dropped */
+    _Bool reconfiguring;
+    /* For BENCH_CONN_QUEUE only */
+    VCOS_SEMAPHORE_T sem;
+    struct worker workers[BENCH_WORKER_MAX];
+    int n_workers;
+    _Bool stop;
+    /* Buffers which went through the ARM side */
+    unsigned frame_count;
+    long long total_bytes;
+    /*
+     * Of the hop into the dest of a -N run: @frame_count at which forwarding
+     * stops and run_event is posted, or 0
+     */
+    unsigned frame_target;
+    /*
+     * Time at which each buffer of the pool came out of the output port, or
+     * 0 if it has not; MMAL_BUFFER_HEADER_T::user_data points to its slot.
+     */
+    double *stamps;
+    struct bench_hist latency;
+};
+
+/*
+ * A single mapping which the payloads of the pool of a hop are carved from,
+ * in slots of @slot_size, instead of one allocation each.  Twice the pool
+ * size is mapped so that mmal_pool_resize() can allocate before it frees.
+ * The allocator is called from the thread which creates and enables the
+ * connections only.
+ */
+struct pool_arena {
+    uint8_t *base;
+    size_t size, slot_size;
+    unsigned n_slots;
+    /* Stack of the indices of the free slots */
+    unsigned *free_slots;
+    unsigned n_free;
+};
+
+/* Connections of a bench between bench_start() and bench_disconnect() */
+struct bench_run {
+    MMAL_CONNECTION_T *conns[BENCH_STAGE_MAX];
+    struct conn_ctx conn_ctx[BENCH_STAGE_MAX];
+    /* Of the hops whose pool has been put on one; @base is %NULL if not */
+    struct pool_arena arenas[BENCH_STAGE_MAX];
+    /* %NULL for tunnelled hops, which have no ARM side to count on. */
+    struct conn_ctx *ctxs[BENCH_STAGE_MAX];
+    /* 0 if not connected */
+    int n_created;
+    _Bool is_capture;
+    /*
+     * When the frames were let go, i.e. the connections were enabled or the
+     * capture was started, and the frame count of the dest at that time
+     */
+    double start_time;
+    unsigned dest_frame_count;
+};
+
+/*
+ * Writes what a file dest receives to disk on its own thread so that the
+ * MMAL callback never waits for the disk: cb_endpoint() copies each buffer
+ * into the next free slot of @ring, and the thread writes all the filled
+ * ones with one writev().  A buffer which finds the ring full is dropped and
+ * counted as discarded.  Slots [@head, @tail) are filled; both only count up
+ * and are taken modulo WRITER_SLOTS.
+ */
+struct writer {
+    int fd;
+    VCOS_THREAD_T thread;
+    VCOS_SEMAPHORE_T sem;
+    VCOS_MUTEX_T lock;
+    uint8_t *ring;
+    size_t slot_size;
+    size_t lengths[WRITER_SLOTS];
+    unsigned head, tail;
+    _Bool stop;
+    long long written;
+    /* Set by the thread once a write fails; the slots are dropped since */
+    _Bool failed;
+};
+
+/*
+ * ARM side of a port which has no component to connect to.  The output of an
+ * encoder dest or of the stage before BENCH_DEST_FILE is drained.  The input of
+ * BENCH_SOURCE_DECODE is fed from cfg->stream in chunks of buffer_size, and the
+ * input of the stage after BENCH_SOURCE_FILE a frame of @frame_size per buffer.
+ * @stats counts the buffers through it and is reported as the one of the
+ * stage; the chunks of a stream are not counted as frames.  @pool is %NULL
+ * until endpoint_enable(); the rest is set before it.  @running is cleared
+ * under @lock before the port is disabled, as with conn_ctx::running.
+ */
+struct endpoint {
+    MMAL_PORT_T *port;
+    MMAL_POOL_T *pool;
+    const uint8_t *data;
+    size_t size, offset;
+    /* 0 to feed in chunks of the buffer size */
+    size_t frame_size;
+    /*
+     * Point the buffers into @data instead of copying into their payloads,
+     * which is possible without zero copy as MMAL then transfers the payload
+     * from wherever it is
+     */
+    _Bool by_reference;
+    /* Of BENCH_DEST_FILE only: where the drained buffers go, and its file */
+    struct writer *writer;
+    char sink_path[256];
+    VCOS_MUTEX_T lock;
+    _Bool running;
+    MMAL_PARAMETER_STATISTICS_T stats;
+    /* As conn_ctx::frame_target, for stats.frame_count of a dest */
+    unsigned frame_target;
+};
+
+/* Components kept across runs; see bench_setup(). */
+struct bench {
+    int n_stages;
+    MMAL_COMPONENT_T *cp[BENCH_STAGE_MAX];
+    /* What the components were created as */
+    struct bench_stage_config stages[BENCH_STAGE_MAX];
+    /* Kept connected across the trials with --reuse */
+    struct bench_run run;
+    /* Of the stages which stage_endpoint() gives a port for */
+    struct endpoint endpoints[BENCH_STAGE_MAX];
+    /*
+     * Frames fed by BENCH_SOURCE_FILE: cfg->stream itself if its frames are
+     * laid out as the port takes them, or else @repacked, which is allocated
+     * by bench_setup()
+     */
+    const uint8_t *frames;
+    size_t frames_size;
+    uint8_t *repacked;
+    struct bench_setup_times times;
+};
+
+static int hist_index(const uint32_t usec)
+{
+    int msb;
+
+    if (usec < BENCH_HIST_SUB_BUCKETS)
+        return usec;
+    msb = 31 - __builtin_clz(usec);
+    return ((msb - BENCH_HIST_SUB_BITS + 1) << BENCH_HIST_SUB_BITS)
+            + ((usec >> (msb - BENCH_HIST_SUB_BITS)) - BENCH_HIST_SUB_BUCKETS);
+}
+
+/* Return: The largest value which falls into bucket @index. */
+static double hist_bucket_max(const int index)
+{
+    const int shift = (index >> BENCH_HIST_SUB_BITS) - 1;
+    const int sub = index & (BENCH_HIST_SUB_BUCKETS - 1);
+
+    if (shift < 0)
+        return sub;
+    return ((double) (BENCH_HIST_SUB_BUCKETS + sub + 1) * (1u << shift)) - 1;
+}
+
+static void hist_add(struct bench_hist * const hist, const double sec)
+{
+    const double usec = sec * 1e6;
+
+    hist->buckets[hist_index(usec >= UINT32_MAX ? UINT32_MAX : usec)] ++;
+    hist->count ++;
+    if (usec > hist->max)
+        hist->max = usec;
+    hist->sum += usec;
+    hist->sum_sq += usec * usec;
+}
+
+static double hist_mean(const struct bench_hist * const hist)
+{
+    return hist->count == 0 ? 0 : hist->sum / hist->count;
+}
+
+/* Return: Sample standard deviation of the values in us. */
+static double hist_stddev(const struct bench_hist * const hist)
+{
+    const double mean = hist_mean(hist);
+
+    if (hist->count < 2)
+        return 0;
+    return sqrt(MMAL_MAX(0, (hist->sum_sq - hist->count * mean * mean)
+                / (hist->count - 1)));
+}
+
+/* Return: Upper bound of the @p quantile (0 < @p <= 1) in microseconds. */
+static double hist_quantile(const struct bench_hist * const hist,
+        const double p)
+{
+    const double target = p * hist->count;
+    unsigned sum = 0;
+    int index;
+
+    for (index = 0; index < BENCH_HIST_BUCKETS; index ++) {
+        sum += hist->buckets[index];
+        if (sum >= target && sum != 0) {
+            const double v = hist_bucket_max(index);
+            return v < hist->max ? v : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+static void show_hist(const char * const name,
+        const struct bench_hist * const hist)
+{
+    print_info("%s: count: %u\n", name, hist->count);
+    if (hist->count == 0)
+        return;
+    print_info("%s: p50: %.0f [us]\n", name, hist_quantile(hist, 0.5));
+    print_info("%s: p90: %.0f [us]\n", name, hist_quantile(hist, 0.9));
+    print_info("%s: p99: %.0f [us]\n", name, hist_quantile(hist, 0.99));
+    print_info("%s: p99.9: %.0f [us]\n", name, hist_quantile(hist, 0.999));
+    print_info("%s: max: %.0f [us]\n", name, hist->max);
+}
+
+/*
+ * Wakes up the wait of run_bench() for the window: posted when a dest of a -N
+ * run has counted its frames, and when a component reports an error or a
+ * call fails in a callback or a thread, which ends the run.  @error is the
+ * status of the first error since the run started, or MMAL_SUCCESS.
+ *
+ * Past their creation, the locks and semaphores are used unchecked, as
+ * vcos_mutex_unlock() is: with pthreads they only fail on one which has not
+ * been created.
+ */
+static struct {
+    VCOS_SEMAPHORE_T sem;
+    volatile MMAL_STATUS_T error;
+} run_event;
+
+/*
+ * Ends the run with @err, for the callbacks and the threads, which have no
+ * caller to return it to.
+ */
+static void run_fail(const MMAL_STATUS_T err)
+{
+    if (run_event.error == MMAL_SUCCESS)
+        run_event.error = err == MMAL_SUCCESS ? MMAL_EIO : err;
+    vcos_semaphore_post(&run_event.sem);
+}
+
+static void cb_control(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+    if (buffer->cmd == MMAL_EVENT_ERROR) {
+        const MMAL_STATUS_T err = buffer->length >= sizeof(err)
+                ? *(MMAL_STATUS_T *) buffer->data : MMAL_EIO;
+        print_error("Error event from %s: %s\n", port->name,
+                mmal_status_to_string(err));
+        run_fail(err);
+    } else
+        print_info("Called by %s\n", port->name);
+    mmal_buffer_header_release(buffer);
+}
+
+static _Bool is_planar_420(const MMAL_FOURCC_T encoding)
+{
+    return encoding == MMAL_ENCODING_I420 || encoding == MMAL_ENCODING_NV12;
+}
+
+/*
+ * Return: Bytes of a frame of @encoding as laid out by config_port(), i.e.
+ * with the width padded to 32 and the height to 16, or 0 for opaque frames,
+ * which stay in VideoCore memory and are passed as handles.
+ */
+static unsigned frame_bytes(const MMAL_FOURCC_T encoding, const int width,
+        const int height)
+{
+    const unsigned stride = mmal_encoding_width_to_stride(encoding,
+            VCOS_ALIGN_UP(width, 32));
+    const unsigned rows = VCOS_ALIGN_UP(height, 16);
+
+    if (encoding == MMAL_ENCODING_OPAQUE)
+        return 0;
+    /* The chroma of 4:2:0 is half the size of the luma plane. */
+    if (is_planar_420(encoding))
+        return stride * rows * 3 / 2;
+    return stride * rows;
+}
+
+/*
+ * Return: Bytes of the image of a frame of @encoding without the padding of
+ * config_port(), i.e. of its crop, or 0 for opaque frames.
+ */
+static unsigned frame_effective_bytes(const MMAL_FOURCC_T encoding,
+        const int width, const int height)
+{
+    const unsigned stride = mmal_encoding_width_to_stride(encoding, width);
+
+    if (encoding == MMAL_ENCODING_OPAQUE)
+        return 0;
+    if (is_planar_420(encoding))
+        return stride * height * 3 / 2;
+    return stride * height;
+}
+
+/* Smallest cache line of the Pi models, so that every line is touched */
+#define CACHE_LINE 32
+
+/*
+ * Counts the bytes of @p into @hist.  Four sub-histograms are used in turn so
+ * that increments of the same value do not wait for each other.
+ */
+static void histogram_bytes(unsigned * const hist, const uint8_t *p,
+        size_t n)
+{
+    unsigned sub[4][256];
+    int i;
+
+    memset(sub, 0, sizeof(sub));
+    for (; n >= 4; n -= 4, p += 4) {
+        sub[0][p[0]] ++;
+        sub[1][p[1]] ++;
+        sub[2][p[2]] ++;
+        sub[3][p[3]] ++;
+    }
+    for (; n > 0; n --, p ++)
+        sub[0][*p] ++;
+    for (i = 0; i < 256; i ++)
+        hist[i] += sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+}
+
+/*
+ * Makes ctx->scratch at least @size bytes for BENCH_PROCESS_MEMCPY; @size is
+ * the buffer size of the output port, which a format change may raise.
+ *
+ * Return: 0 on success, or -ENOMEM.
+ */
+static int ctx_size_scratch(struct conn_ctx * const ctx, const size_t size)
+{
+    void *scratch;
+
+    if (ctx->process != BENCH_PROCESS_MEMCPY || size <= ctx->scratch_size)
+        return 0;
+    scratch = realloc(ctx->scratch, size);
+    if (scratch == NULL)
+        return -ENOMEM;
+    ctx->scratch = scratch;
+    ctx->scratch_size = size;
+    return 0;
+}
+
+/*
+ * Does ctx->process on the payload of @buffer, which came out of @port.
+ * Opaque payloads are handles to VideoCore memory and cannot be read from
+ * the ARM, so only BENCH_PROCESS_BUSY is done on them.  A payload which
+ * cannot be locked ends the run.  Called with ctx->lock held.
+ */
+static void process_buffer(struct conn_ctx * const ctx,
+        const MMAL_PORT_T * const port, MMAL_BUFFER_HEADER_T * const buffer)
+{
+    const double start = get_time();
+    const uint8_t *data;
+    MMAL_STATUS_T err;
+    size_t i, len;
+
+    if (ctx->process == BENCH_PROCESS_NONE)
+        return;
+    if (ctx->process == BENCH_PROCESS_BUSY) {
+        while ((get_time() - start) * 1e6 < ctx->process_arg)
+            ;
+        goto out;
+    }
+    if (port->format->encoding == MMAL_ENCODING_OPAQUE)
+        goto out;
+    err = mmal_buffer_header_mem_lock(buffer);
+    if (err != MMAL_SUCCESS) {
+        print_error("Failed to lock a payload of %s: %s\n", port->name,
+                mmal_status_to_string(err));
+        ctx->running = 0;
+        run_fail(err);
+        goto out;
+    }
+    data = buffer->data + buffer->offset;
+    len = buffer->length;
+    switch (ctx->process) {
+        case BENCH_PROCESS_TOUCH:
+            for (i = 0; i < len; i += CACHE_LINE)
+                ctx->touched ^= data[i];
+            break;
+        case BENCH_PROCESS_MEMCPY:
+            memcpy(ctx->scratch, data, len);
+            break;
+        case BENCH_PROCESS_HISTOGRAM:
+            /* Luma is the first plane of 4:2:0; count every byte else. */
+            if (is_planar_420(port->format->encoding))
+                len = MMAL_MIN(len, (size_t) port->format->es->video.width
+                        * port->format->es->video.height);
+            histogram_bytes(ctx->histogram, data, len);
+            break;
+        case BENCH_PROCESS_NONE:
+        case BENCH_PROCESS_BUSY:
+            break;
+    }
+    mmal_buffer_header_mem_unlock(buffer);
+out:
+    ctx->process_time += get_time() - start;
+}
+
+/* Latencies from the PTS above this [s] are taken as unmapped PTS. */
+#define PTS_LATENCY_MAX 10.0
+
+/*
+ * Handles @buffer, an event from conn->out instead of a frame.  A format
+ * change, which vc.ril.video_decode sends before its first frame, is applied
+ * to the connection, and the stamps are pointed again as the pool may have
+ * been reallocated, and the scratch of BENCH_PROCESS_MEMCPY grown to the new
+ * buffer size.  Other events are dropped.  Called and returns with
+ * ctx->lock held; it is dropped meanwhile as applying the change may disable
+ * the connection, which calls back into cb_conn().  A failure ends the run.
+ */
+static void conn_event(MMAL_CONNECTION_T * const conn,
+        MMAL_BUFFER_HEADER_T * const buffer)
+{
+    struct conn_ctx * const ctx = conn->user_data;
+    MMAL_POOL_T *pool;
+    MMAL_STATUS_T err;
+    double *stamps;
+    unsigned j;
+
+    if (buffer->cmd != MMAL_EVENT_FORMAT_CHANGED) {
+        mmal_buffer_header_release(buffer);
+        return;
+    }
+    ctx->reconfiguring = !0;
+    vcos_mutex_unlock(&ctx->lock);
+    err = mmal_connection_event_format_changed(conn, buffer);
+    mmal_buffer_header_release(buffer);
+    vcos_mutex_lock(&ctx->lock);
+    ctx->reconfiguring = 0;
+    if (err == MMAL_SUCCESS
+            && ctx_size_scratch(ctx, conn->out->buffer_size) != 0)
+        err = MMAL_ENOMEM;
+    pool = conn->pool;
+    stamps = err != MMAL_SUCCESS ? NULL
+            : realloc(ctx->stamps, pool->headers_num * sizeof(*stamps));
+    if (stamps == NULL) {
+        print_error("Failed to apply the format change of %s: %s\n",
+                conn->out->name, err != MMAL_SUCCESS
+                ? mmal_status_to_string(err) : "no memory for stamps");
+        ctx->running = 0;
+        run_fail(err != MMAL_SUCCESS ? err : MMAL_ENOMEM);
+        return;
+    }
+    ctx->stamps = stamps;
+    memset(stamps, 0, pool->headers_num * sizeof(*stamps));
+    for (j = 0; j < pool->headers_num; j ++)
+        pool->header[j]->user_data = &stamps[j];
+}
+
+/*
+ * Sends filled buffers from the output port to the input port, and buffers
+ * released by the input port back to the output port to be filled again.
+ * The time between the two is recorded as the latency of the dest.  Events
+ * from the output port go to conn_event() and are neither stamped nor sent.
+ * A buffer which cannot be sent is left in its queue to be flushed, and ends
+ * the run.
+ */
+static void forward_buffers(MMAL_CONNECTION_T *conn)
+{
+    struct conn_ctx * const ctx = conn->user_data;
+    MMAL_BUFFER_HEADER_T *buffer;
+    MMAL_STATUS_T err;
+
+    vcos_mutex_lock(&ctx->lock);
+    if (ctx->running && !ctx->reconfiguring) {
+        while ((buffer = mmal_queue_get(conn->queue)) != NULL) {
+            double *stamp;
+            if (buffer->cmd != 0) {
+                conn_event(conn, buffer);
+                if (!ctx->running)
+                    break;
+                continue;
+            }
+            stamp = buffer->user_data;
+            *stamp = get_time();
+            if (ctx->first_arrival == 0)
+                ctx->first_arrival = *stamp;
+            if (ctx->stc_offset != 0 && buffer->pts != MMAL_TIME_UNKNOWN) {
+                const double lat = *stamp
+                        - (buffer->pts * 1e-6 + ctx->stc_offset);
+                if (lat >= 0 && lat < PTS_LATENCY_MAX)
+                    hist_add(&ctx->pts_latency, lat);
+                else
+                    ctx->pts_unmapped ++;
+            }
+            if (ctx->last_arrival != 0)
+                hist_add(&ctx->interval, *stamp - ctx->last_arrival);
+            ctx->last_arrival = *stamp;
+            process_buffer(ctx, conn->out, buffer);
+            if (ctx->delay_usec > 0) {
+                vcos_mutex_unlock(&ctx->lock);
+                usleep(ctx->delay_usec);
+                vcos_mutex_lock(&ctx->lock);
+            }
+            /*
+             * The ports may be disabled by now, or processing may have
+             * failed; leave it to be flushed.
+             */
+            if (!ctx->running) {
+                mmal_queue_put_back(conn->queue, buffer);
+                break;
+            }
+            err = mmal_port_send_buffer(conn->in, buffer);
+            if (err != MMAL_SUCCESS) {
+                print_error("Failed to send a buffer to %s: %s\n",
+                        conn->in->name, mmal_status_to_string(err));
+                mmal_queue_put_back(conn->queue, buffer);
+                ctx->running = 0;
+                run_fail(err);
+                break;
+            }
+            ctx->frame_count ++;
+            ctx->total_bytes += buffer->length;
+            if (ctx->frame_target != 0
+                    && ctx->frame_count >= ctx->frame_target) {
+                /* The rest waits in the queue to be flushed. */
+                ctx->running = 0;
+                vcos_semaphore_post(&run_event.sem);
+                break;
+            }
+        }
+        while ((buffer = mmal_queue_get(conn->pool->queue)) != NULL) {
+            double * const stamp = buffer->user_data;
+            if (*stamp != 0) {
+                hist_add(&ctx->latency, get_time() - *stamp);
+                *stamp = 0;
+            }
+            err = mmal_port_send_buffer(conn->out, buffer);
+            if (err != MMAL_SUCCESS) {
+                print_error("Failed to send a buffer to %s: %s\n",
+                        conn->out->name, mmal_status_to_string(err));
+                mmal_queue_put_back(conn->pool->queue, buffer);
+                ctx->running = 0;
+                run_fail(err);
+                break;
+            }
+        }
+    }
+    vcos_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Called by MMAL whenever a buffer is queued to conn->queue or is returned to
+ * conn->pool.  Forwards the buffers right here for BENCH_CONN_CALLBACK, or
+ * wakes up the pump thread for BENCH_CONN_QUEUE.
+ */
+static void cb_conn(MMAL_CONNECTION_T *conn)
+{
+    struct conn_ctx * const ctx = conn->user_data;
+
+    switch (ctx->conn) {
+        case BENCH_CONN_CALLBACK:
+            forward_buffers(conn);
+            break;
+        case BENCH_CONN_QUEUE:
+            vcos_semaphore_post(&ctx->sem);
+            break;
+        case BENCH_CONN_TUNNEL:
+            break;
+    }
+}
+
+/*
+ * Pins the calling thread and sets its policy as in @w.  A failure ends the
+ * run, and the worker goes on as it is so that it pumps until it is stopped.
+ */
+static void setup_worker(const struct worker * const w)
+{
+    int ret;
+
+    if (w->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret) {
+            print_error("Failed to pin a worker to CPU %d: %s\n", w->cpu,
+                    strerror(ret));
+            run_fail(MMAL_EINVAL);
+        }
+    }
+    if (w->fifo_priority > 0) {
+        const struct sched_param param = {
+            .sched_priority = w->fifo_priority,
+        };
+        ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret) {
+            print_error("Failed to set SCHED_FIFO %d on a worker: %s\n",
+                    w->fifo_priority, strerror(ret));
+            run_fail(MMAL_EINVAL);
+        }
+    }
+}
+
+/*
+ * Forwards the buffers whenever cb_conn() says there are some.  All the
+ * workers of a connection wait on the same semaphore, and forward_buffers()
+ * serializes them.
+ */
+static void *pump_thread(void *arg)
+{
+    struct worker * const w = arg;
+    MMAL_CONNECTION_T * const conn = w->conn;
+    struct conn_ctx * const ctx = conn->user_data;
+
+    setup_worker(w);
+    for (; ; ) {
+        vcos_semaphore_wait(&ctx->sem);
+        if (ctx->stop)
+            break;
+        forward_buffers(conn);
+    }
+    return NULL;
+}
+
+/* Writes the filled slots of @w until it is stopped and they are all out. */
+static void *writer_thread(void *arg)
+{
+    struct writer * const w = arg;
+
+    for (; ; ) {
+        struct iovec iov[WRITER_SLOTS];
+        unsigned head, tail, n, i;
+        _Bool stop;
+
+        vcos_semaphore_wait(&w->sem);
+        vcos_mutex_lock(&w->lock);
+        head = w->head;
+        tail = w->tail;
+        stop = w->stop;
+        vcos_mutex_unlock(&w->lock);
+        if (head == tail) {
+            if (stop)
+                break;
+            continue;
+        }
+        n = tail - head;
+        for (i = 0; i < n; i ++) {
+            const unsigned slot = (head + i) % WRITER_SLOTS;
+            iov[i].iov_base = w->ring + slot * w->slot_size;
+            iov[i].iov_len = w->lengths[slot];
+        }
+        /* Short writes leave the rest in @iov to be written. */
+        for (i = 0; i < n && !w->failed; ) {
+            ssize_t len = writev(w->fd, iov + i, n - i);
+            if (len == -1) {
+                if (errno == EINTR)
+                    continue;
+                print_error("Failed to write the sink: %s\n",
+                        strerror(errno));
+                w->failed = !0;
+                run_fail(MMAL_EIO);
+                break;
+            }
+            w->written += len;
+            for (; i < n && (size_t) len >= iov[i].iov_len; i ++)
+                len -= iov[i].iov_len;
+            if (i < n) {
+                iov[i].iov_base = (uint8_t *) iov[i].iov_base + len;
+                iov[i].iov_len -= len;
+            }
+        }
+        vcos_mutex_lock(&w->lock);
+        w->head = tail;
+        vcos_mutex_unlock(&w->lock);
+    }
+    return NULL;
+}
+
+/*
+ * Creates @path and a writer into it with slots of @slot_size bytes.
+ *
+ * Return: The writer, or %NULL on failure.
+ */
+static struct writer *writer_create(const char * const path,
+        const size_t slot_size)
+{
+    struct writer * const w = calloc(1, sizeof(*w));
+
+    if (w == NULL || (w->ring = malloc(WRITER_SLOTS * slot_size)) == NULL) {
+        print_error("Failed to allocate the writer of %s\n", path);
+        goto free_w;
+    }
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd == -1) {
+        print_error("Failed to open %s: %s\n", path, strerror(errno));
+        goto free_w;
+    }
+    w->slot_size = slot_size;
+    if (vcos_mutex_create(&w->lock, "writer") != VCOS_SUCCESS)
+        goto close_fd;
+    if (vcos_semaphore_create(&w->sem, "writer", 0) != VCOS_SUCCESS)
+        goto delete_lock;
+    if (vcos_thread_create(&w->thread, "writer", NULL, writer_thread, w)
+            != VCOS_SUCCESS)
+        goto delete_sem;
+    return w;
+
+delete_sem:
+    vcos_semaphore_delete(&w->sem);
+delete_lock:
+    vcos_mutex_delete(&w->lock);
+close_fd:
+    print_error("Failed to start the writer of %s\n", path);
+    close(w->fd);
+free_w:
+    if (w != NULL)
+        free(w->ring);
+    free(w);
+    return NULL;
+}
+
+/*
+ * Copies the payload of @buffer into the next free slot of @w.  A payload
+ * which cannot be locked ends the run.
+ *
+ * Return: Whether it has been copied into a free slot.
+ */
+static _Bool writer_push(struct writer * const w,
+        MMAL_BUFFER_HEADER_T * const buffer)
+{
+    const size_t len = MMAL_MIN((size_t) buffer->length, w->slot_size);
+    MMAL_STATUS_T err;
+    unsigned slot;
+
+    vcos_mutex_lock(&w->lock);
+    slot = w->tail % WRITER_SLOTS;
+    if (w->tail - w->head == WRITER_SLOTS) {
+        vcos_mutex_unlock(&w->lock);
+        return 0;
+    }
+    vcos_mutex_unlock(&w->lock);
+    /* The slot is ours until @tail is advanced past it. */
+    err = mmal_buffer_header_mem_lock(buffer);
+    if (err != MMAL_SUCCESS) {
+        print_error("Failed to lock a payload for the sink: %s\n",
+                mmal_status_to_string(err));
+        run_fail(err);
+        return 0;
+    }
+    memcpy(w->ring + slot * w->slot_size, buffer->data + buffer->offset, len);
+    mmal_buffer_header_mem_unlock(buffer);
+    w->lengths[slot] = len;
+    vcos_mutex_lock(&w->lock);
+    w->tail ++;
+    vcos_mutex_unlock(&w->lock);
+    vcos_semaphore_post(&w->sem);
+    return !0;
+}
+
+/*
+ * Writes out what is left in @w and frees it.  A failure to close @path is
+ * reported and the rest is freed all the same.
+ */
+static void writer_destroy(struct writer * const w, const char * const path)
+{
+    vcos_mutex_lock(&w->lock);
+    w->stop = !0;
+    vcos_mutex_unlock(&w->lock);
+    vcos_semaphore_post(&w->sem);
+    vcos_thread_join(&w->thread, NULL);
+    print_info("%s: written %lld bytes\n", path, w->written);
+    if (close(w->fd) == -1)
+        print_error("Failed to close %s: %s\n", path, strerror(errno));
+    vcos_semaphore_delete(&w->sem);
+    vcos_mutex_delete(&w->lock);
+    free(w->ring);
+    free(w);
+}
+
+/*
+ * Sends the free buffers of @ep to its port, filled with the next chunks of
+ * the stream if it is fed.  A buffer which cannot be sent is put back and
+ * ends the run.  Called with ep->lock held.
+ */
+static void endpoint_refill(struct endpoint * const ep)
+{
+    MMAL_BUFFER_HEADER_T *buffer;
+    MMAL_STATUS_T err;
+
+    if (!ep->running)
+        return;
+    while ((buffer = mmal_queue_get(ep->pool->queue)) != NULL) {
+        if (ep->frame_size != 0) {
+            if (ep->by_reference) {
+                buffer->data = (uint8_t *) ep->data + ep->offset;
+                buffer->alloc_size = ep->frame_size;
+            } else
+                memcpy(buffer->data, ep->data + ep->offset, ep->frame_size);
+            buffer->offset = 0;
+            buffer->length = ep->frame_size;
+            buffer->flags = MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+            buffer->pts = buffer->dts = MMAL_TIME_UNKNOWN;
+            ep->offset = (ep->offset + ep->frame_size) % ep->size;
+            ep->stats.buffer_count ++;
+            ep->stats.frame_count ++;
+            ep->stats.total_bytes += ep->frame_size;
+        } else if (ep->data != NULL) {
+            const size_t len = MMAL_MIN(ep->size - ep->offset,
+                    (size_t) buffer->alloc_size);
+            memcpy(buffer->data, ep->data + ep->offset, len);
+            buffer->offset = 0;
+            buffer->length = len;
+            buffer->flags = 0;
+            buffer->pts = buffer->dts = MMAL_TIME_UNKNOWN;
+            ep->offset = (ep->offset + len) % ep->size;
+            ep->stats.buffer_count ++;
+            ep->stats.total_bytes += len;
+        }
+        err = mmal_port_send_buffer(ep->port, buffer);
+        if (err != MMAL_SUCCESS) {
+            print_error("Failed to send a buffer to %s: %s\n",
+                    ep->port->name, mmal_status_to_string(err));
+            mmal_queue_put_back(ep->pool->queue, buffer);
+            ep->running = 0;
+            run_fail(err);
+            return;
+        }
+    }
+}
+
+/*
+ * Called by MMAL when the port of an endpoint is done with @buffer: counts
+ * what came out of a drained port, and sends the buffer back, or the next
+ * chunk of the stream for a fed one.
+ */
+static void cb_endpoint(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+    struct endpoint * const ep = (struct endpoint *) port->userdata;
+
+    vcos_mutex_lock(&ep->lock);
+    if (ep->data == NULL && buffer->cmd == 0 && (ep->frame_target == 0
+                || ep->stats.frame_count < ep->frame_target)) {
+        ep->stats.buffer_count ++;
+        ep->stats.total_bytes += buffer->length;
+        /* Codec config such as the SPS and PPS of H.264 is no frame. */
+        if ((buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)
+                && !(buffer->flags & MMAL_BUFFER_HEADER_FLAG_CONFIG))
+            ep->stats.frame_count ++;
+        if (ep->writer != NULL && buffer->length != 0
+                && !writer_push(ep->writer, buffer))
+            ep->stats.frames_discarded ++;
+        if (ep->frame_target != 0 && ep->stats.frame_count >= ep->frame_target)
+            vcos_semaphore_post(&run_event.sem);
+    }
+    mmal_buffer_header_release(buffer);
+    endpoint_refill(ep);
+    vcos_mutex_unlock(&ep->lock);
+}
+
+static const char *stage_name(const struct bench_stage_config * const stage)
+{
+    switch (stage->kind) {
+        case BENCH_STAGE_SOURCE:
+            return bench_source_table[stage->type];
+        case BENCH_STAGE_FILTER:
+            return bench_filter_table[stage->type];
+        case BENCH_STAGE_DEST:
+            return bench_dest_table[stage->type];
+    }
+    return NULL;
+}
+
+static const char *stage_to_mmal(const struct bench_stage_config * const stage)
+{
+    switch (stage->kind) {
+        case BENCH_STAGE_SOURCE:
+            return source_to_mmal[stage->type];
+        case BENCH_STAGE_FILTER:
+            return filter_to_mmal[stage->type];
+        case BENCH_STAGE_DEST:
+            return dest_to_mmal[stage->type];
+    }
+    return NULL;
+}
+
+/*
+ * Return: Index of the hop whose counters are reported as the conn ones,
+ * which is the first one into a dest.
+ */
+static int dest_hop(const struct bench_config * const cfg)
+{
+    int i;
+
+    for (i = 0; i < cfg->n_hops; i ++)
+        if (cfg->stages[cfg->hops[i].to].kind == BENCH_STAGE_DEST)
+            return i;
+    return cfg->n_hops - 1;
+}
+
+/* Return: Index of the stage whose stats are reported as the dest ones. */
+static int dest_stage(const struct bench_config * const cfg)
+{
+    return cfg->hops[dest_hop(cfg)].to;
+}
+
+/*
+ * Names stage @i for reports: "source" and "dest" as with a single
+ * connection, "destN" if there are several dests, and the filter name
+ * followed by the stage index otherwise.
+ */
+static void stage_label(const struct bench_config * const cfg, const int i,
+        char * const buf, const size_t size)
+{
+    const struct bench_stage_config * const stage = &cfg->stages[i];
+    int j, n_dests = 0, nth = 0;
+
+    for (j = 0; j < cfg->n_stages; j ++) {
+        if (cfg->stages[j].kind != BENCH_STAGE_DEST)
+            continue;
+        if (j < i)
+            nth ++;
+        n_dests ++;
+    }
+    switch (stage->kind) {
+        case BENCH_STAGE_SOURCE:
+            snprintf(buf, size, "source");
+            break;
+        case BENCH_STAGE_FILTER:
+            snprintf(buf, size, "%s%d", stage_name(stage), i);
+            break;
+        case BENCH_STAGE_DEST:
+            if (n_dests == 1)
+                snprintf(buf, size, "dest");
+            else
+                snprintf(buf, size, "dest%d", nth);
+            break;
+    }
+}
+
+/* Names hop @i for reports: "conn" for a single connection, "hopN" else. */
+static void hop_label(const struct bench_config * const cfg, const int i,
+        char * const buf, const size_t size)
+{
+    if (cfg->n_hops == 1)
+        snprintf(buf, size, "conn");
+    else
+        snprintf(buf, size, "hop%d", i);
+}
+
+/*
+ * Writes the pipeline as in -P, with the connection method of each hop after
+ * the stage it goes into, e.g. "source:isp@tunnel:null@callback".
+ */
+static void format_pipeline(const struct bench_config * const cfg,
+        char * const buf, const size_t size)
+{
+    size_t len = 0;
+    int i, j;
+
+    buf[0] = '\0';
+    for (i = 0; i < cfg->n_stages && len < size; i ++) {
+        len += snprintf(buf + len, size - len, "%s%s", i == 0 ? "" : ":",
+                stage_name(&cfg->stages[i]));
+        for (j = 0; j < cfg->n_hops && len < size; j ++)
+            if (cfg->hops[j].to == i) {
+                len += snprintf(buf + len, size - len, "@%s",
+                        bench_conn_table[cfg->hops[j].conn]);
+                if (cfg->hops[j].delay_usec > 0 && len < size)
+                    len += snprintf(buf + len, size - len, "+%d",
+                            cfg->hops[j].delay_usec);
+            }
+    }
+}
+
+/* Return: Whether @stage is a component, unlike the file source and dest. */
+static _Bool stage_has_component(const struct bench_stage_config * const stage)
+{
+    return !(stage->kind == BENCH_STAGE_SOURCE
+                && stage->type == BENCH_SOURCE_FILE)
+            && !(stage->kind == BENCH_STAGE_DEST
+                && stage->type == BENCH_DEST_FILE);
+}
+
+/*
+ * Return: Whether hop @i comes from BENCH_SOURCE_FILE or goes into
+ * BENCH_DEST_FILE, which feed or drain the port at its other end from the ARM
+ * side through an endpoint instead of a connection.
+ */
+static _Bool hop_is_endpoint(const struct bench_config * const cfg,
+        const int i)
+{
+    return !stage_has_component(&cfg->stages[cfg->hops[i].from])
+            || !stage_has_component(&cfg->stages[cfg->hops[i].to]);
+}
+
+/*
+ * Return: Whether hop @i is a callback or queue connection, which has the
+ * ARM-side counters of struct conn_ctx.
+ */
+static _Bool hop_has_ctx(const struct bench_config * const cfg, const int i)
+{
+    return cfg->hops[i].conn != BENCH_CONN_TUNNEL && !hop_is_endpoint(cfg, i);
+}
+
+static MMAL_PORT_T *hop_port_out(const struct bench * const b,
+        const struct bench_hop_config * const hop)
+{
+    return b->cp[hop->from]->output[hop->port];
+}
+
+static MMAL_PORT_T *hop_port_in(const struct bench * const b,
+        const struct bench_hop_config * const hop)
+{
+    return b->cp[hop->to]->input[0];
+}
+
+/*
+ * Return: The port of stage @i which can be queried for
+ * MMAL_PARAMETER_STATISTICS, or %NULL if the stage has none.  Only
+ * vc.ril.source and vc.ril.video_render have an ability to do it here.  Note
+ * that the latter always sets total_bytes to 0.
+ */
+static MMAL_PORT_T *stage_stats_port(const struct bench * const b,
+        const struct bench_config * const cfg, const int i)
+{
+    const struct bench_stage_config * const stage = &cfg->stages[i];
+
+    if (stage->kind == BENCH_STAGE_SOURCE && stage->type == BENCH_SOURCE_SOURCE)
+        return b->cp[i]->output[cfg->source_output_port];
+    if (stage->kind == BENCH_STAGE_DEST && stage->type == BENCH_DEST_RENDER)
+        return b->cp[i]->input[0];
+    return NULL;
+}
+
+/*
+ * Return: The port of stage @i which is driven by an endpoint, i.e. the
+ * input of BENCH_SOURCE_DECODE, the input BENCH_SOURCE_FILE goes into, the
+ * output of an encoder dest or the output BENCH_DEST_FILE comes from, or
+ * %NULL, as for a file whose hop has no component at the other end either.
+ */
+static MMAL_PORT_T *stage_endpoint(const struct bench * const b,
+        const struct bench_config * const cfg, const int i)
+{
+    const struct bench_stage_config * const stage = &cfg->stages[i];
+    int j;
+
+    if (stage->kind == BENCH_STAGE_SOURCE && stage->type == BENCH_SOURCE_DECODE)
+        return b->cp[i]->input[0];
+    if (stage->kind == BENCH_STAGE_SOURCE && stage->type == BENCH_SOURCE_FILE) {
+        for (j = 0; j < cfg->n_hops; j ++)
+            if (cfg->hops[j].from == i && b->cp[cfg->hops[j].to] != NULL)
+                return hop_port_in(b, &cfg->hops[j]);
+        return NULL;
+    }
+    if (stage->kind == BENCH_STAGE_DEST && stage->type == BENCH_DEST_FILE) {
+        for (j = 0; j < cfg->n_hops; j ++)
+            if (cfg->hops[j].to == i && b->cp[cfg->hops[j].from] != NULL)
+                return hop_port_out(b, &cfg->hops[j]);
+        return NULL;
+    }
+    if (stage->kind == BENCH_STAGE_DEST && dest_to_encoding[stage->type] != 0)
+        return b->cp[i]->output[0];
+    return NULL;
+}
+
+/* perf_event_open() counter of the data TLB misses, or -1 */
+static int dtlb_fd = -1;
+
+/*
+ * Starts counting the data TLB read misses of this process.  This must be
+ * called before any thread is created as only the threads created after it
+ * are counted.  The count is left unknown if the kernel or the CPU cannot
+ * do it.
+ */
+static void open_dtlb_counter(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB
+            | PERF_COUNT_HW_CACHE_OP_READ << 8
+            | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    dtlb_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (dtlb_fd == -1)
+        print_info("Data TLB misses are not counted: %s\n", strerror(errno));
+}
+
+/* Return: Data TLB misses so far, or -1 if they are not counted. */
+static long long read_dtlb_misses(void)
+{
+    uint64_t count;
+
+    if (dtlb_fd == -1 || read(dtlb_fd, &count, sizeof(count))
+            != sizeof(count))
+        return -1;
+    return count;
+}
+
+/*
+ * Return: Sum of ctrl_tx_count and ctrl_rx_count in the VCHIQ state which
+ * reading /dev/vchiq dumps, or -1 if it cannot be read.
+ */
+static long long read_vchiq_msgs(void)
+{
+    /* The dump has a few lines per service; only the run thread reads it. */
+    static char buf[1 << 16];
+    const char *tx, *rx;
+    size_t len = 0;
+    ssize_t ret;
+    const int fd = open("/dev/vchiq", O_RDONLY);
+
+    if (fd == -1)
+        return -1;
+    while (len < sizeof(buf) - 1
+            && (ret = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0)
+        len += ret;
+    close(fd);
+    buf[len] = '\0';
+    tx = strstr(buf, "ctrl_tx_count=");
+    rx = strstr(buf, "ctrl_rx_count=");
+    if (tx == NULL || rx == NULL)
+        return -1;
+    return strtoll(tx + strlen("ctrl_tx_count="), NULL, 10)
+            + strtoll(rx + strlen("ctrl_rx_count="), NULL, 10);
+}
+
+/*
+ * Reads @c.  getrusage() is used for this process instead of /proc/self/stat
+ * as it gives the same times in microseconds and the context switches of all
+ * the threads, which /proc/self/status only has for the main one.
+ */
+static void read_cpu_counters(struct bench_cpu_counters * const c)
+{
+    unsigned long long v[8] = {0};
+    struct rusage ru;
+    FILE *fp;
+    int i;
+
+    memset(c, 0, sizeof(*c));
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        c->user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6;
+        c->sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+        c->nvcsw = ru.ru_nvcsw;
+        c->nivcsw = ru.ru_nivcsw;
+    }
+    /* cpu user nice system idle iowait irq softirq steal */
+    fp = fopen("/proc/stat", "r");
+    if (fp != NULL) {
+        if (fscanf(fp, "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &v[0],
+                    &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) >= 4) {
+            for (i = 0; i < 8; i ++)
+                c->total += v[i];
+            c->busy = c->total - v[3] - v[4];
+        }
+        fclose(fp);
+    }
+    c->vchiq_msgs = read_vchiq_msgs();
+}
+
+/* Sets @d to @end minus @begin. */
+static void sub_cpu_counters(struct bench_cpu_counters * const d,
+        const struct bench_cpu_counters * const end,
+        const struct bench_cpu_counters * const begin)
+{
+    d->user = end->user - begin->user;
+    d->sys = end->sys - begin->sys;
+    d->nvcsw = end->nvcsw - begin->nvcsw;
+    d->nivcsw = end->nivcsw - begin->nivcsw;
+    d->busy = end->busy - begin->busy;
+    d->total = end->total - begin->total;
+    d->vchiq_msgs = begin->vchiq_msgs < 0 || end->vchiq_msgs < 0 ? -1
+            : end->vchiq_msgs - begin->vchiq_msgs;
+}
+
+/* /dev/vcio for the mailbox properties, or -1, and whether gencmd is up */
+static int vcio_fd = -1;
+static _Bool is_gencmd = 0;
+
+/* Clocks of the mailbox property interface */
+#define MBOX_CLOCK_ARM  3
+#define MBOX_CLOCK_CORE 4
+#define MBOX_CLOCK_H264 6
+#define MBOX_CLOCK_ISP  7
+
+/*
+ * Opens the mailbox and gencmd, either of which may not be there, in which
+ * case what it would give is left unknown.
+ */
+static void open_gpu_state(void)
+{
+    vcio_fd = open("/dev/vcio", O_RDWR);
+    if (vcio_fd == -1)
+        print_info("GPU state is not read: /dev/vcio: %s\n",
+                strerror(errno));
+    is_gencmd = vc_gencmd_init() == 0;
+    if (!is_gencmd)
+        print_info("GPU heap is not read: vc_gencmd_init failed\n");
+}
+
+/*
+ * Gets mailbox property @tag, which takes @arg as its argument and whose
+ * value is 2 words, the second of which is returned.
+ *
+ * Return: The value, or -1 if it cannot be got.
+ */
+static long long mbox_get(const uint32_t tag, const uint32_t arg)
+{
+    uint32_t buf[8] __attribute__((aligned(16))) = {
+        sizeof(buf), 0, tag, 8, 0, arg, 0, 0,
+    };
+
+    if (vcio_fd == -1 || ioctl(vcio_fd, _IOWR(100, 0, char *), buf) == -1
+            || buf[1] != 0x80000000 || !(buf[4] & 0x80000000))
+        return -1;
+    return tag == 0x00030046 ? buf[5] : buf[6];
+}
+
+/* Return: The measured rate of @clock in MHz, or the set one, or -1. */
+static int mbox_clock_mhz(const uint32_t clock)
+{
+    long long hz = mbox_get(0x00030047, clock);
+
+    if (hz <= 0)
+        hz = mbox_get(0x00030002, clock);
+    return hz <= 0 ? -1 : (int) (hz / 1000000);
+}
+
+/* Return: The free heap @name as in get_mem of gencmd [MB], or -1. */
+static int gencmd_mem_mb(const char * const name)
+{
+    char buf[64];
+    const char *eq;
+
+    if (!is_gencmd || vc_gencmd(buf, sizeof(buf), "get_mem %s", name) != 0)
+        return -1;
+    eq = strchr(buf, '=');
+    return eq == NULL ? -1 : atoi(eq + 1);
+}
+
+/*
+ * Reads the GPU state into @g.  The heaps are read only if @is_heap is set,
+ * and are left unknown otherwise: gencmd goes over VCHIQ, so it is kept out
+ * of the measurement window, which the mailbox is not.
+ */
+static void read_gpu_state(struct bench_gpu_state * const g,
+        const _Bool is_heap)
+{
+    const long long temp = mbox_get(0x00030006, 0);
+
+    g->arm_mhz = mbox_clock_mhz(MBOX_CLOCK_ARM);
+    g->core_mhz = mbox_clock_mhz(MBOX_CLOCK_CORE);
+    g->isp_mhz = mbox_clock_mhz(MBOX_CLOCK_ISP);
+    g->h264_mhz = mbox_clock_mhz(MBOX_CLOCK_H264);
+    g->temp = temp < 0 ? -1 : temp * 1e-3;
+    g->throttled = mbox_get(0x00030046, 0);
+    g->reloc_free_mb = is_heap ? gencmd_mem_mb("reloc") : -1;
+    g->malloc_free_mb = is_heap ? gencmd_mem_mb("malloc") : -1;
+}
+
+/* Return: The lower of @a and @b which are known, or -1. */
+static int min_known(const int a, const int b)
+{
+    if (a < 0)
+        return b;
+    if (b < 0)
+        return a;
+    return MMAL_MIN(a, b);
+}
+
+/* Merges @g into @worst as the worst of them; see bench_result::gpu_during. */
+static void merge_gpu_state(struct bench_gpu_state * const worst,
+        const struct bench_gpu_state * const g)
+{
+    worst->arm_mhz = min_known(worst->arm_mhz, g->arm_mhz);
+    worst->core_mhz = min_known(worst->core_mhz, g->core_mhz);
+    worst->isp_mhz = min_known(worst->isp_mhz, g->isp_mhz);
+    worst->h264_mhz = min_known(worst->h264_mhz, g->h264_mhz);
+    worst->temp = MMAL_MAX(worst->temp, g->temp);
+    if (g->throttled >= 0)
+        worst->throttled = worst->throttled < 0 ? g->throttled
+                : worst->throttled | g->throttled;
+    worst->reloc_free_mb = min_known(worst->reloc_free_mb, g->reloc_free_mb);
+    worst->malloc_free_mb = min_known(worst->malloc_free_mb,
+            g->malloc_free_mb);
+}
+
+/*
+ * Return: Bits 0 to 3 of get_throttled which hold at some point of the run,
+ * or which have newly occurred in it, or -1 if it is unknown.
+ */
+static long long throttled_in_run(const struct bench_result * const res)
+{
+    const long long begin = res->gpu_begin.throttled;
+    const long long end = res->gpu_end.throttled;
+
+    if (begin < 0 || end < 0)
+        return -1;
+    return ((res->gpu_during.throttled < 0 ? 0 : res->gpu_during.throttled)
+            | end | (end & ~begin) >> 16) & 0xf;
+}
+
+static void sleep_msec(const int msec)
+{
+    struct timespec t = {
+        .tv_sec = msec / 1000,
+        .tv_nsec = (msec % 1000) * 1000000L,
+    };
+
+    while (nanosleep(&t, &t) == -1 && errno == EINTR)
+        ;
+}
+
+/* Reads the stats of @port; ones which cannot be read are 0 and end the run. */
+static void get_stats(MMAL_PORT_T * const port,
+        MMAL_PARAMETER_STATISTICS_T * const param)
+{
+    MMAL_STATUS_T err;
+
+    *param = (MMAL_PARAMETER_STATISTICS_T) {
+        .hdr = {
+            .id = MMAL_PARAMETER_STATISTICS,
+            .size = sizeof(*param),
+        },
+    };
+    err = mmal_port_parameter_get(port, &param->hdr);
+    if (err != MMAL_SUCCESS) {
+        print_error("Failed to get the stats of %s: %s\n", port->name,
+                mmal_status_to_string(err));
+        memset(param, 0, sizeof(*param));
+        run_fail(err);
+    }
+}
+
+/* Return: Whether stage_get_stats() can be called for stage @i. */
+static _Bool stage_has_stats(const struct bench * const b,
+        const struct bench_config * const cfg, const int i)
+{
+    return stage_stats_port(b, cfg, i) != NULL
+            || stage_endpoint(b, cfg, i) != NULL;
+}
+
+/* Takes the stats of stage @i from the component or from its endpoint. */
+static void stage_get_stats(struct bench * const b,
+        const struct bench_config * const cfg, const int i,
+        MMAL_PARAMETER_STATISTICS_T * const param)
+{
+    struct endpoint * const ep = &b->endpoints[i];
+
+    if (stage_endpoint(b, cfg, i) != NULL) {
+        vcos_mutex_lock(&ep->lock);
+        *param = ep->stats;
+        vcos_mutex_unlock(&ep->lock);
+        return;
+    }
+    get_stats(stage_stats_port(b, cfg, i), param);
+}
+
+/* Subtracts the counters in @begin from the ones in @param. */
+static void sub_stats(MMAL_PARAMETER_STATISTICS_T * const param,
+        const MMAL_PARAMETER_STATISTICS_T * const begin)
+{
+    param->buffer_count -= begin->buffer_count;
+    param->frame_count -= begin->frame_count;
+    param->frames_skipped -= begin->frames_skipped;
+    param->frames_discarded -= begin->frames_discarded;
+    param->total_bytes -= begin->total_bytes;
+}
+
+/* Counters of a run at a point in time */
+struct snapshot {
+    double time;
+    long long dtlb_misses;
+    struct bench_cpu_counters cpu;
+    MMAL_PARAMETER_STATISTICS_T stats[BENCH_STAGE_MAX];
+    unsigned conn_frame_count[BENCH_STAGE_MAX];
+    long long conn_total_bytes[BENCH_STAGE_MAX];
+    double conn_process_time[BENCH_STAGE_MAX];
+};
+
+/*
+ * Takes the stats of the stages which res->stages[] say have them, and the
+ * ARM-side counters of the hops whose @ctxs are not %NULL.  The CPU counters
+ * are read only if @is_edge is set, at the edges of the measurement window:
+ * the dump of /dev/vchiq takes the VCHIQ state which is being measured, so
+ * it is kept out of the samples in between.  Counters which are not
+ * available or not read are left zero.
+ */
+static void take_snapshot(struct snapshot * const snap,
+        struct bench * const b, const struct bench_config * const cfg,
+        struct conn_ctx * const * const ctxs,
+        const struct bench_result * const res, const _Bool is_edge)
+{
+    int i;
+
+    memset(snap, 0, sizeof(*snap));
+    for (i = 0; i < cfg->n_hops; i ++) {
+        struct conn_ctx * const ctx = ctxs[i];
+        if (ctx == NULL)
+            continue;
+        vcos_mutex_lock(&ctx->lock);
+        snap->conn_frame_count[i] = ctx->frame_count;
+        snap->conn_total_bytes[i] = ctx->total_bytes;
+        snap->conn_process_time[i] = ctx->process_time;
+        vcos_mutex_unlock(&ctx->lock);
+    }
+    snap->time = get_time();
+    snap->dtlb_misses = read_dtlb_misses();
+    if (is_edge)
+        read_cpu_counters(&snap->cpu);
+    for (i = 0; i < cfg->n_stages; i ++)
+        if (res->stages[i].has_stats)
+            stage_get_stats(b, cfg, i, &snap->stats[i]);
+}
+
+/*
+ * Shows @param of a stage.  The payload is also given as the bytes a frame
+ * takes with its padding and as the bytes of its image, whose difference is
+ * the bandwidth lost to the alignment of config_port().
+ */
+static void show_stats(const char * const name,
+        const MMAL_PARAMETER_STATISTICS_T * const param, const double elapsed,
+        const struct bench_config * const cfg)
+{
+    const MMAL_FOURCC_T encoding = encoding_to_mmal[cfg->encoding];
+    const double padded = (double) param->frame_count
+            * frame_bytes(encoding, cfg->width, cfg->height) / elapsed;
+    const double effective = (double) param->frame_count
+            * frame_effective_bytes(encoding, cfg->width, cfg->height)
+            / elapsed;
+
+    print_info("%s: buffer_count: %u\n", name,  param->buffer_count);
+    print_info("%s: frame_count: %u\n", name, param->frame_count);
+    print_info("%s: frames_skipped: %u\n", name, param->frames_skipped);
+    print_info("%s: frames_discarded: %u\n", name, param->frames_discarded);
+    print_info("%s: total_bytes: %lld\n", name, param->total_bytes);
+    print_info("%s: %f [frame/s]\n", name, param->frame_count / elapsed);
+    print_info("%s: %e [B/s]\n", name, param->total_bytes / elapsed);
+    if (padded > 0)
+        print_info("%s: payload: padded %e [B/s], effective %e [B/s] "
+                "(%.1f%% padding)\n", name, padded, effective,
+                (padded - effective) / padded * 100);
+}
+
+/* Writes cfg->cpus as in -A, or "-" if not given. */
+static void format_cpus(const struct bench_config * const cfg,
+        char * const buf, const size_t size)
+{
+    size_t len = 0;
+    int i;
+
+    snprintf(buf, size, "-");
+    for (i = 0; i < cfg->n_cpus && len < size; i ++)
+        len += snprintf(buf + len, size - len, "%s%d", i == 0 ? "" : ",",
+                cfg->cpus[i]);
+}
+
+static void show_config(const struct bench_config * const cfg)
+{
+    char fourcc[5], pipeline[256], cpus[64];
+
+    print_info("encoding: %s (%s)\n", bench_encoding_table[cfg->encoding],
+            mmal_4cc_to_string(fourcc, sizeof(fourcc),
+                encoding_to_mmal[cfg->encoding]));
+    print_info("width: %d\n", cfg->width);
+    print_info("height: %d\n", cfg->height);
+    print_info("frame_bytes: %u\n", frame_bytes(
+                encoding_to_mmal[cfg->encoding], cfg->width, cfg->height));
+    print_info("frame_effective_bytes: %u\n", frame_effective_bytes(
+                encoding_to_mmal[cfg->encoding], cfg->width, cfg->height));
+    print_info("fps: %f\n", cfg->fps);
+    print_info("msec: %d\n", cfg->msec);
+    print_info("frames: %u\n", cfg->frames);
+    print_info("warmup_msec: %d\n", cfg->warmup_msec);
+    print_info("source: %s (%s)\n", bench_source_table[cfg->source],
+            source_to_mmal[cfg->source]);
+    print_info("pattern: %s\n", bench_pattern_table[cfg->pattern]);
+    print_info("camera_num: %d\n", cfg->camera_num);
+    print_info("source_output_port: %d\n", cfg->source_output_port);
+    print_info("dest: %s (%s)\n", bench_dest_table[cfg->dest],
+            dest_to_mmal[cfg->dest]);
+    print_info("conn: %s\n", bench_conn_table[cfg->hops[dest_hop(cfg)].conn]);
+    format_pipeline(cfg, pipeline, sizeof(pipeline));
+    print_info("pipeline: %s\n", pipeline);
+    print_info("zero_copy: %d\n", cfg->zero_copy);
+    print_info("buffer_num: %u\n", cfg->buffer_num);
+    print_info("buffer_size: %u\n", cfg->buffer_size);
+    format_cpus(cfg, cpus, sizeof(cpus));
+    print_info("workers: %d\n", cfg->workers);
+    print_info("cpus: %s\n", cpus);
+    print_info("fifo_priority: %d\n", cfg->fifo_priority);
+    print_info("reuse: %d\n", cfg->reuse);
+    print_info("process: %s (%d)\n", bench_process_table[cfg->process],
+            cfg->process_arg);
+    print_info("arena: %s\n", bench_arena_table[cfg->arena]);
+    print_info("bitrate: %u\n", cfg->bitrate);
+    print_info("profile: %s\n",
+            cfg->profile < 0 ? "-" : bench_profile_table[cfg->profile]);
+    print_info("intra_period: %d\n", cfg->intra_period);
+    print_info("codec: %s\n", bench_codec_table[cfg->codec]);
+    print_info("stream: %s (%zu bytes)\n",
+            cfg->stream_path == NULL ? "-" : cfg->stream_path,
+            cfg->stream_size);
+    print_info("sink: %s\n", cfg->sink_path == NULL ? "-" : cfg->sink_path);
+}
+
+/*
+ * Return: The throughput of the most downstream point that counts frames, in
+ * frame/s.
+ */
+static double result_fps(const struct bench_config * const cfg,
+        const struct bench_result * const res)
+{
+    const struct bench_stage_result * const dest =
+            &res->stages[dest_stage(cfg)];
+    const struct bench_hop_result * const hop = &res->hops[dest_hop(cfg)];
+
+    if (dest->has_stats)
+        return dest->stats.frame_count / res->elapsed;
+    if (hop->frame_count != 0)
+        return hop->frame_count / res->elapsed;
+    if (res->stages[0].has_stats)
+        return res->stages[0].stats.frame_count / res->elapsed;
+    return 0;
+}
+
+/*
+ * Return: The throughput in B/s of the ARM side of the hop into the dest, or
+ * else of the source.  vc.ril.video_render does not count bytes.
+ */
+static double result_Bps(const struct bench_config * const cfg,
+        const struct bench_result * const res)
+{
+    const struct bench_hop_result * const hop = &res->hops[dest_hop(cfg)];
+
+    if (hop->total_bytes != 0)
+        return hop->total_bytes / res->elapsed;
+    if (res->stages[0].has_stats)
+        return res->stages[0].stats.total_bytes / res->elapsed;
+    return 0;
+}
+
+/*
+ * Shows where the setup time of a run went.  Component creation and format
+ * commits are done by bench_setup() and so are counted in the first trial of
+ * a configuration only.
+ */
+static void show_setup_times(const struct bench_setup_times * const t)
+{
+    print_info("setup: component_create: %f [ms]\n",
+            t->component_create * 1e3);
+    print_info("setup: format_commit: %f [ms]\n", t->format_commit * 1e3);
+    print_info("setup: component_destroy: %f [ms]\n",
+            t->component_destroy * 1e3);
+    print_info("setup: connection_create: %f [ms]\n",
+            t->connection_create * 1e3);
+    print_info("setup: connection_enable: %f [ms]\n",
+            t->connection_enable * 1e3);
+    print_info("setup: connection_disable: %f [ms]\n",
+            t->connection_disable * 1e3);
+    print_info("setup: arena_alloc: %f [ms]\n", t->arena_alloc * 1e3);
+}
+
+/*
+ * Shows the ARM CPU use in the window as percentages of one core for this
+ * process and of all the cores for the system, and its cost per frame of
+ * result_fps().
+ */
+static void show_cpu(const struct bench_config * const cfg,
+        const struct bench_result * const res)
+{
+    const struct bench_cpu_counters * const c = &res->cpu;
+    const double frames = result_fps(cfg, res) * res->elapsed;
+
+    print_info("cpu: user %.1f%%, sys %.1f%% (of a core), system %.1f%% "
+            "(of all cores)\n", c->user / res->elapsed * 100,
+            c->sys / res->elapsed * 100,
+            c->total == 0 ? 0 : (double) c->busy / c->total * 100);
+    print_info("ctx_switches: %ld voluntary, %ld involuntary\n", c->nvcsw,
+            c->nivcsw);
+    if (c->vchiq_msgs >= 0)
+        print_info("vchiq: %lld messages\n", c->vchiq_msgs);
+    if (frames < 1)
+        return;
+    print_info("cpu: %f [us/frame], %.2f ctx_switches/frame\n",
+            (c->user + c->sys) / frames * 1e6,
+            (c->nvcsw + c->nivcsw) / frames);
+    if (c->vchiq_msgs >= 0)
+        print_info("vchiq: %.2f [messages/frame]\n", c->vchiq_msgs / frames);
+}
+
+static void show_gpu_state(const char * const name,
+        const struct bench_gpu_state * const g)
+{
+    print_info("gpu: %s: arm %d, core %d, isp %d, h264 %d [MHz], %.1f ['C], "
+            "throttled 0x%llx, reloc %d, malloc %d [MB free]\n", name,
+            g->arm_mhz, g->core_mhz, g->isp_mhz, g->h264_mhz, g->temp,
+            g->throttled, g->reloc_free_mb, g->malloc_free_mb);
+}
+
+/*
+ * Shows the GPU state around the run of @res, and says so if it has been
+ * throttled, which makes its numbers say nothing of the pipeline.
+ */
+static void show_gpu(const struct bench_result * const res)
+{
+    static const char * const throttled_names[] = {
+        "under-voltage", "arm frequency capped", "throttled",
+        "soft temperature limit",
+    };
+    const long long bits = throttled_in_run(res);
+    int i;
+
+    show_gpu_state("before", &res->gpu_begin);
+    show_gpu_state("during", &res->gpu_during);
+    show_gpu_state("after", &res->gpu_end);
+    for (i = 0; bits > 0 && i < 4; i ++)
+        if (bits & (1 << i))
+            print_info("gpu: %s in the run\n", throttled_names[i]);
+}
+
+/* Return: Index of the vc.ril.video_splitter stage, or -1 if there is none. */
+static int split_stage(const struct bench_config * const cfg)
+{
+    int i;
+
+    for (i = 0; i < cfg->n_stages; i ++)
+        if (cfg->stages[i].kind == BENCH_STAGE_FILTER
+                && cfg->stages[i].type == BENCH_FILTER_SPLITTER)
+            return i;
+    return -1;
+}
+
+/*
+ * Return: Frames per second that went through hop @i, counted by the stage it
+ * goes into or else on the ARM side, or -1 if neither can count them.
+ */
+static double hop_fps(const struct bench_config * const cfg,
+        const struct bench_result * const res, const int i)
+{
+    const struct bench_stage_result * const to = &res->stages[cfg->hops[i].to];
+
+    if (to->has_stats)
+        return to->stats.frame_count / res->elapsed;
+    if (hop_has_ctx(cfg, i))
+        return res->hops[i].frame_count / res->elapsed;
+    return -1;
+}
+
+/* Return: The highest hop_fps() of the branches of the splitter @split. */
+static double branch_fps_max(const struct bench_config * const cfg,
+        const struct bench_result * const res, const int split)
+{
+    double max = -1;
+    int i;
+
+    for (i = 0; i < cfg->n_hops; i ++)
+        if (cfg->hops[i].from == split)
+            max = MMAL_MAX(max, hop_fps(cfg, res, i));
+    return max;
+}
+
+/*
+ * Shows the throughput of each branch of the splitter and how far behind the
+ * fastest one it is, which tells how much a slow consumer holds back the
+ * others: they all share the buffers of the input of the splitter.
+ */
+static void show_branches(const struct bench_config * const cfg,
+        const struct bench_result * const res)
+{
+    const int split = split_stage(cfg);
+    double max;
+    int i;
+
+    if (split < 0)
+        return;
+    max = branch_fps_max(cfg, res, split);
+    for (i = 0; i < cfg->n_hops; i ++) {
+        const struct bench_hop_config * const hop = &cfg->hops[i];
+        const double fps = hop_fps(cfg, res, i);
+        if (hop->from != split)
+            continue;
+        if (fps < 0)
+            print_info("branch%d: %s@%s: not counted\n", hop->port,
+                    stage_name(&cfg->stages[hop->to]),
+                    bench_conn_table[hop->conn]);
+        else
+            print_info("branch%d: %s@%s: %f [frame/s], %.1f%% of the "
+                    "fastest\n", hop->port,
+                    stage_name(&cfg->stages[hop->to]),
+                    bench_conn_table[hop->conn], fps,
+                    max > 0 ? fps / max * 100 : 0);
+    }
+}
+
+static void show_result(const struct bench_config * const cfg,
+        const struct bench_result * const res)
+{
+    const double elapsed = res->elapsed;
+    char name[64];
+    int i;
+
+    if (cfg->n_instances > 1)
+        print_info("instance: %d of %d\n", cfg->instance, cfg->n_instances);
+    print_info("trial: %u%s\n", res->trial,
+            res->is_outlier ? " (outlier)" : "");
+    show_setup_times(&res->setup);
+    if (res->ttff < 0)
+        print_info("ttff: not seen\n");
+    else
+        print_info("ttff: %f [ms]\n", res->ttff * 1e3);
+    if (res->dtlb_misses >= 0)
+        print_info("dtlb_misses: %lld (%e [/s])\n", res->dtlb_misses,
+                res->dtlb_misses / elapsed);
+    for (i = 0; i < cfg->n_stages; i ++) {
+        if (!res->stages[i].has_stats)
+            continue;
+        stage_label(cfg, i, name, sizeof(name));
+        show_stats(name, &res->stages[i].stats, elapsed, cfg);
+    }
+    show_cpu(cfg, res);
+    show_gpu(res);
+    for (i = 0; i < cfg->n_hops; i ++) {
+        const struct bench_hop_result * const hop = &res->hops[i];
+        hop_label(cfg, i, name, sizeof(name));
+        if (cfg->n_hops > 1)
+            print_info("%s: %s -> %s: %s\n", name,
+                    stage_name(&cfg->stages[cfg->hops[i].from]),
+                    stage_name(&cfg->stages[cfg->hops[i].to]),
+                    bench_conn_table[cfg->hops[i].conn]);
+        print_info("%s: buffer_num: %u\n", name, hop->buffer_num);
+        print_info("%s: buffer_size: %u\n", name, hop->buffer_size);
+        if (!hop_has_ctx(cfg, i))
+            continue;
+        print_info("%s: frame_count: %u\n", name, hop->frame_count);
+        print_info("%s: total_bytes: %lld\n", name, hop->total_bytes);
+        print_info("%s: %f [frame/s]\n", name, hop->frame_count / elapsed);
+        print_info("%s: %e [B/s]\n", name, hop->total_bytes / elapsed);
+        if (cfg->process != BENCH_PROCESS_NONE && hop->frame_count != 0)
+            print_info("%s: process: %f [us/frame]\n", name,
+                    hop->process_time / hop->frame_count * 1e6);
+        {
+            char sub[80];
+            snprintf(sub, sizeof(sub), "%s: latency", name);
+            show_hist(sub, &hop->latency);
+            snprintf(sub, sizeof(sub), "%s: pts_latency", name);
+            show_hist(sub, &hop->pts_latency);
+            if (hop->pts_unmapped != 0)
+                print_info("%s: unmapped: %u\n", sub, hop->pts_unmapped);
+            snprintf(sub, sizeof(sub), "%s: interval", name);
+            show_hist(sub, &hop->interval);
+            if (hop->interval.count != 0)
+                print_info("%s: mean %.0f [us], jitter (stddev) %.0f [us]\n",
+                        sub, hist_mean(&hop->interval),
+                        hist_stddev(&hop->interval));
+        }
+    }
+    if (cfg->fps > 0)
+        print_info("rate: requested %f, achieved %f [frame/s] (%.1f%%)\n",
+                cfg->fps, result_fps(cfg, res),
+                result_fps(cfg, res) / cfg->fps * 100);
+    show_branches(cfg, res);
+}
+
+/*
+ * Writer of one flat record of key-value pairs, either as a JSON object on a
+ * line or as a CSV row.  With @header set, CSV keys are written instead of the
+ * values so that the header and the rows come from the same code.  Keys are
+ * prefixed with @prefix if set, and values are written as missing while
+ * @absent is set.
+ */
+struct record {
+    FILE *fp;
+    enum bench_format format;
+    _Bool header;
+    const char *prefix;
+    _Bool absent;
+    int n;
+};
+
+/* Return: Non-zero if the value for the key has to be written. */
+static int record_key(struct record * const r, const char * const key)
+{
+    if (r->format == BENCH_FORMAT_JSON)
+        fprintf(r->fp, "%s\"", r->n == 0 ? "{" : ", ");
+    else if (r->n != 0)
+        fputc(',', r->fp);
+    r->n ++;
+    if (r->format == BENCH_FORMAT_JSON || r->header) {
+        if (r->prefix != NULL)
+            fprintf(r->fp, "%s_", r->prefix);
+        fputs(key, r->fp);
+    }
+    if (r->format == BENCH_FORMAT_JSON)
+        fputs("\": ", r->fp);
+    if (r->header)
+        return 0;
+    if (r->absent) {
+        /* Missing values are null in JSON and empty fields in CSV. */
+        if (r->format == BENCH_FORMAT_JSON)
+            fputs("null", r->fp);
+        return 0;
+    }
+    return !0;
+}
+
+static void record_str(struct record * const r, const char * const key,
+        const char *val)
+{
+    if (!record_key(r, key))
+        return;
+    fputc('"', r->fp);
+    for (; *val != '\0'; val ++) {
+        if (*val == '"' || (r->format == BENCH_FORMAT_JSON && *val == '\\'))
+            fputc(r->format == BENCH_FORMAT_JSON ? '\\' : '"', r->fp);
+        fputc(*val, r->fp);
+    }
+    fputc('"', r->fp);
+}
+
+static void record_num(struct record * const r, const char * const key,
+        const char * const fmt, ...)
+{
+    va_list ap;
+
+    if (!record_key(r, key))
+        return;
+    va_start(ap, fmt);
+    vfprintf(r->fp, fmt, ap);
+    va_end(ap);
+}
+
+static void record_end(struct record * const r)
+{
+    if (r->format == BENCH_FORMAT_JSON)
+        fputc('}', r->fp);
+    fputc('\n', r->fp);
+    fflush(r->fp);
+    r->n = 0;
+}
+
+static void record_stats(struct record * const r, const char * const name,
+        const _Bool valid, const MMAL_PARAMETER_STATISTICS_T * const param,
+        const double elapsed, const struct bench_config * const cfg)
+{
+    const MMAL_FOURCC_T encoding = encoding_to_mmal[cfg->encoding];
+    const unsigned padded = frame_bytes(encoding, cfg->width, cfg->height);
+    const unsigned effective = frame_effective_bytes(encoding, cfg->width,
+            cfg->height);
+
+    r->prefix = name;
+    r->absent = !valid;
+    record_num(r, "buffer_count", "%u", param->buffer_count);
+    record_num(r, "frame_count", "%u", param->frame_count);
+    record_num(r, "frames_skipped", "%u", param->frames_skipped);
+    record_num(r, "frames_discarded", "%u", param->frames_discarded);
+    record_num(r, "total_bytes", "%lld", param->total_bytes);
+    record_num(r, "fps", "%f", param->frame_count / elapsed);
+    record_num(r, "Bps", "%e", param->total_bytes / elapsed);
+    r->absent = !valid || padded == 0;
+    record_num(r, "padded_Bps", "%e",
+            (double) param->frame_count * padded / elapsed);
+    record_num(r, "effective_Bps", "%e",
+            (double) param->frame_count * effective / elapsed);
+    r->prefix = NULL;
+    r->absent = 0;
+}
+
+static void record_hist(struct record * const r, const char * const name,
+        const _Bool valid, const struct bench_hist * const hist)
+{
+    r->prefix = name;
+    r->absent = !valid;
+    record_num(r, "count", "%u", hist->count);
+    r->absent = !valid || hist->count == 0;
+    record_num(r, "p50_us", "%.0f", hist_quantile(hist, 0.5));
+    record_num(r, "p90_us", "%.0f", hist_quantile(hist, 0.9));
+    record_num(r, "p99_us", "%.0f", hist_quantile(hist, 0.99));
+    record_num(r, "p999_us", "%.0f", hist_quantile(hist, 0.999));
+    record_num(r, "max_us", "%.0f", hist->max);
+    r->prefix = NULL;
+    r->absent = 0;
+}
+
+/* JSON version of show_branches(), as branchN_* keys. */
+static void record_branches(struct record * const r,
+        const struct bench_config * const cfg,
+        const struct bench_result * const res)
+{
+    const int split = split_stage(cfg);
+    char prefix[64];
+    double max;
+    int i;
+
+    if (split < 0)
+        return;
+    max = branch_fps_max(cfg, res, split);
+    for (i = 0; i < cfg->n_hops; i ++) {
+        const struct bench_hop_config * const hop = &cfg->hops[i];
+        const double fps = hop_fps(cfg, res, i);
+        if (hop->from != split)
+            continue;
+        snprintf(prefix, sizeof(prefix), "branch%d", hop->port);
+        r->prefix = prefix;
+        record_str(r, "dest", stage_name(&cfg->stages[hop->to]));
+        record_str(r, "conn", bench_conn_table[hop->conn]);
+        record_num(r, "delay_usec", "%d", hop->delay_usec);
+        r->absent = fps < 0;
+        record_num(r, "fps", "%f", fps);
+        r->absent = fps < 0 || max <= 0;
+        record_num(r, "rel_fastest", "%f", fps / max);
+        r->absent = 0;
+    }
+    r->prefix = NULL;
+}
+
+/* Writes the CPU and VCHIQ counters of a run, also per frame. */
+static void record_cpu(struct record * const r,
+        const struct bench_config * const cfg,
+        const struct bench_result * const res)
+{
+    const struct bench_cpu_counters * const c = &res->cpu;
+    const double frames = result_fps(cfg, res) * res->elapsed;
+
+    record_num(r, "cpu_user_pct", "%f", c->user / res->elapsed * 100);
+    record_num(r, "cpu_sys_pct", "%f", c->sys / res->elapsed * 100);
+    record_num(r, "cpu_system_pct", "%f",
+            c->total == 0 ? 0 : (double) c->busy / c->total * 100);
+    record_num(r, "ctxsw_voluntary", "%ld", c->nvcsw);
+    record_num(r, "ctxsw_involuntary", "%ld", c->nivcsw);
+    r->absent = c->vchiq_msgs < 0;
+    record_num(r, "vchiq_msgs", "%lld", c->vchiq_msgs);
+    r->absent = frames < 1;
+    record_num(r, "cpu_us_per_frame", "%f",
+            (c->user + c->sys) / frames * 1e6);
+    record_num(r, "ctxsw_per_frame", "%f", (c->nvcsw + c->nivcsw) / frames);
+    r->absent = frames < 1 || c->vchiq_msgs < 0;
+    record_num(r, "vchiq_msgs_per_frame", "%f", c->vchiq_msgs / frames);
+    r->absent = 0;
+}
+
+static void record_gpu_state(struct record * const r,
+        const char * const name, const struct bench_gpu_state * const g)
+{
+    r->prefix = name;
+    r->absent = g->arm_mhz < 0;
+    record_num(r, "arm_mhz", "%d", g->arm_mhz);
+    r->absent = g->core_mhz < 0;
+    record_num(r, "core_mhz", "%d", g->core_mhz);
+    r->absent = g->isp_mhz < 0;
+    record_num(r, "isp_mhz", "%d", g->isp_mhz);
+    r->absent = g->h264_mhz < 0;
+    record_num(r, "h264_mhz", "%d", g->h264_mhz);
+    r->absent = g->temp < 0;
+    record_num(r, "temp_c", "%.1f", g->temp);
+    r->absent = g->throttled < 0;
+    record_num(r, "throttled", "%lld", g->throttled);
+    r->absent = g->reloc_free_mb < 0;
+    record_num(r, "reloc_free_mb", "%d", g->reloc_free_mb);
+    r->absent = g->malloc_free_mb < 0;
+    record_num(r, "malloc_free_mb", "%d", g->malloc_free_mb);
+    r->prefix = NULL;
+    r->absent = 0;
+}
+
+/*
+ * Writes the configuration and the result of a run as a single record.  The
+ * conn and latency keys are the ones of the hop into the dest; JSON records of
+ * a pipeline carry every hop too, as hopN_*.
+ */
+static void record_result(struct record * const r,
+        const struct bench_config * const cfg,
+        const struct bench_result * const res)
+{
+    const int last = dest_hop(cfg);
+    const struct bench_stage_result * const source = &res->stages[0];
+    const struct bench_stage_result * const dest =
+            &res->stages[dest_stage(cfg)];
+    char fourcc[5], pipeline[256], prefix[64], cpus[64];
+    int i;
+
+    format_pipeline(cfg, pipeline, sizeof(pipeline));
+    format_cpus(cfg, cpus, sizeof(cpus));
+    record_str(r, "encoding", bench_encoding_table[cfg->encoding]);
+    record_str(r, "fourcc", mmal_4cc_to_string(fourcc, sizeof(fourcc),
+                encoding_to_mmal[cfg->encoding]));
+    record_num(r, "width", "%d", cfg->width);
+    record_num(r, "height", "%d", cfg->height);
+    record_num(r, "frame_bytes", "%u", frame_bytes(
+                encoding_to_mmal[cfg->encoding], cfg->width, cfg->height));
+    record_num(r, "frame_effective_bytes", "%u", frame_effective_bytes(
+                encoding_to_mmal[cfg->encoding], cfg->width, cfg->height));
+    record_num(r, "target_fps", "%f", cfg->fps);
+    record_num(r, "msec", "%d", cfg->msec);
+    record_num(r, "frames", "%d", cfg->frames);
+    record_num(r, "warmup_msec", "%d", cfg->warmup_msec);
+    record_str(r, "source", bench_source_table[cfg->source]);
+    record_str(r, "pattern", bench_pattern_table[cfg->pattern]);
+    record_num(r, "camera_num", "%d", cfg->camera_num);
+    record_num(r, "source_output_port", "%d", cfg->source_output_port);
+    record_str(r, "dest", bench_dest_table[cfg->dest]);
+    record_str(r, "conn", bench_conn_table[cfg->hops[last].conn]);
+    record_str(r, "pipeline", pipeline);
+    record_num(r, "zero_copy", "%d", cfg->zero_copy);
+    record_num(r, "buffer_num", "%u", res->hops[last].buffer_num);
+    record_num(r, "buffer_size", "%u", res->hops[last].buffer_size);
+    record_num(r, "workers", "%d", cfg->workers);
+    record_str(r, "cpus", cpus);
+    record_num(r, "fifo_priority", "%d", cfg->fifo_priority);
+    record_num(r, "reuse", "%d", cfg->reuse);
+    record_str(r, "process", bench_process_table[cfg->process]);
+    record_num(r, "process_arg", "%d", cfg->process_arg);
+    record_str(r, "arena", bench_arena_table[cfg->arena]);
+    record_num(r, "bitrate", "%u", cfg->bitrate);
+    record_str(r, "profile",
+            cfg->profile < 0 ? "-" : bench_profile_table[cfg->profile]);
+    record_num(r, "intra_period", "%d", cfg->intra_period);
+    record_str(r, "codec", bench_codec_table[cfg->codec]);
+    record_str(r, "stream", cfg->stream_path == NULL ? "-" : cfg->stream_path);
+    record_str(r, "sink", cfg->sink_path == NULL ? "-" : cfg->sink_path);
+    record_num(r, "trial", "%u", res->trial);
+    record_num(r, "outlier", "%d", res->is_outlier);
+    record_num(r, "instance", "%d", cfg->instance);
+    record_num(r, "instances", "%d", cfg->n_instances);
+    record_num(r, "elapsed", "%f", res->elapsed);
+    record_stats(r, "source", source->has_stats, &source->stats,
+            res->elapsed, cfg);
+    record_stats(r, "dest", dest->has_stats, &dest->stats, res->elapsed,
+            cfg);
+    for (i = 0; i < cfg->n_hops; i ++) {
+        const struct bench_hop_result * const hop = &res->hops[i];
+        const _Bool has_conn = hop_has_ctx(cfg, i);
+        if (i == last) {
+            r->prefix = "conn";
+        } else if (r->format == BENCH_FORMAT_JSON) {
+            snprintf(prefix, sizeof(prefix), "hop%d", i);
+            r->prefix = prefix;
+        } else
+            continue;
+        r->absent = !has_conn;
+        record_num(r, "frame_count", "%u", hop->frame_count);
+        record_num(r, "total_bytes", "%lld", hop->total_bytes);
+        record_num(r, "fps", "%f", hop->frame_count / res->elapsed);
+        record_num(r, "Bps", "%e", hop->total_bytes / res->elapsed);
+        r->absent = !has_conn || cfg->process == BENCH_PROCESS_NONE
+                || hop->frame_count == 0;
+        record_num(r, "process_us", "%f",
+                hop->process_time / hop->frame_count * 1e6);
+        r->absent = !has_conn || hop->interval.count < 2;
+        record_num(r, "jitter_us", "%.0f", hist_stddev(&hop->interval));
+        r->absent = !has_conn;
+        record_num(r, "pts_unmapped", "%u", hop->pts_unmapped);
+        r->absent = 0;
+        if (i == last) {
+            record_hist(r, "latency", has_conn, &hop->latency);
+            record_hist(r, "pts_latency", has_conn, &hop->pts_latency);
+            record_hist(r, "interval", has_conn, &hop->interval);
+        } else {
+            char name[80];
+            record_str(r, "conn", bench_conn_table[cfg->hops[i].conn]);
+            snprintf(name, sizeof(name), "%s_latency", prefix);
+            record_hist(r, name, has_conn, &hop->latency);
+            snprintf(name, sizeof(name), "%s_pts_latency", prefix);
+            record_hist(r, name, has_conn, &hop->pts_latency);
+            snprintf(name, sizeof(name), "%s_interval", prefix);
+            record_hist(r, name, has_conn, &hop->interval);
+        }
+        r->prefix = NULL;
+    }
+    record_num(r, "achieved_fps", "%f", result_fps(cfg, res));
+    r->prefix = "setup";
+    record_num(r, "component_create_ms", "%f",
+            res->setup.component_create * 1e3);
+    record_num(r, "format_commit_ms", "%f", res->setup.format_commit * 1e3);
+    record_num(r, "component_destroy_ms", "%f",
+            res->setup.component_destroy * 1e3);
+    record_num(r, "connection_create_ms", "%f",
+            res->setup.connection_create * 1e3);
+    record_num(r, "connection_enable_ms", "%f",
+            res->setup.connection_enable * 1e3);
+    record_num(r, "connection_disable_ms", "%f",
+            res->setup.connection_disable * 1e3);
+    record_num(r, "arena_alloc_ms", "%f", res->setup.arena_alloc * 1e3);
+    r->prefix = NULL;
+    r->absent = res->ttff < 0;
+    record_num(r, "ttff_ms", "%f", res->ttff * 1e3);
+    r->absent = res->dtlb_misses < 0;
+    record_num(r, "dtlb_misses", "%lld", res->dtlb_misses);
+    r->absent = 0;
+    record_cpu(r, cfg, res);
+    record_gpu_state(r, "gpu_before", &res->gpu_begin);
+    record_gpu_state(r, "gpu_during", &res->gpu_during);
+    record_gpu_state(r, "gpu_after", &res->gpu_end);
+    r->absent = throttled_in_run(res) < 0;
+    record_num(r, "throttled_in_run", "%lld", throttled_in_run(res));
+    r->absent = 0;
+    record_num(r, "aggregate_fps", "%f", res->aggregate_fps);
+    record_num(r, "aggregate_Bps", "%e", res->aggregate_Bps);
+    if (r->format == BENCH_FORMAT_JSON)
+        record_branches(r, cfg, res);
+    record_end(r);
+}
+
+/*
+ * Reports a run in @format: through print_info for BENCH_FORMAT_TEXT, or as one
+ * record on stdout otherwise.  The CSV header is written before the first row.
+ */
+static void report_result(const enum bench_format format,
+        const struct bench_config * const cfg,
+        const struct bench_result * const res)
+{
+    static _Bool is_header_written = 0;
+    struct record r = {
+        .fp = stdout,
+        .format = format,
+    };
+
+    switch (format) {
+        case BENCH_FORMAT_TEXT:
+            show_result(cfg, res);
+            return;
+        case BENCH_FORMAT_CSV:
+            if (!is_header_written) {
+                r.header = !0;
+                record_result(&r, cfg, res);
+                r.header = 0;
+                is_header_written = !0;
+            }
+            break;
+        case BENCH_FORMAT_JSON:
+            break;
+    }
+    record_result(&r, cfg, res);
+}
+
+static void record_sample(struct record * const r,
+        const struct bench_config * const cfg,
+        const struct bench_result * const res,
+        const struct snapshot * const begin,
+        const struct snapshot * const prev, const struct snapshot * const cur)
+{
+    const double dt = cur->time - prev->time;
+    const int dest = dest_stage(cfg), last = dest_hop(cfg);
+
+    record_str(r, "encoding", bench_encoding_table[cfg->encoding]);
+    record_num(r, "width", "%d", cfg->width);
+    record_num(r, "height", "%d", cfg->height);
+    record_str(r, "dest", bench_dest_table[cfg->dest]);
+    record_str(r, "conn", bench_conn_table[cfg->hops[last].conn]);
+    record_num(r, "buffer_num", "%u", cfg->buffer_num);
+    record_num(r, "trial", "%u", res->trial);
+    record_num(r, "instance", "%d", cfg->instance);
+    record_num(r, "t", "%f", cur->time - begin->time);
+    r->prefix = "source";
+    r->absent = !res->stages[0].has_stats;
+    record_num(r, "fps", "%f",
+            (cur->stats[0].frame_count - prev->stats[0].frame_count) / dt);
+    record_num(r, "Bps", "%e",
+            (cur->stats[0].total_bytes - prev->stats[0].total_bytes) / dt);
+    record_num(r, "frames_skipped", "%u",
+            cur->stats[0].frames_skipped - prev->stats[0].frames_skipped);
+    record_num(r, "frames_discarded", "%u",
+            cur->stats[0].frames_discarded - prev->stats[0].frames_discarded);
+    r->prefix = "dest";
+    r->absent = !res->stages[dest].has_stats;
+    record_num(r, "fps", "%f",
+            (cur->stats[dest].frame_count - prev->stats[dest].frame_count)
+            / dt);
+    record_num(r, "frames_skipped", "%u",
+            cur->stats[dest].frames_skipped
+            - prev->stats[dest].frames_skipped);
+    record_num(r, "frames_discarded", "%u",
+            cur->stats[dest].frames_discarded
+            - prev->stats[dest].frames_discarded);
+    r->prefix = "conn";
+    r->absent = !hop_has_ctx(cfg, last);
+    record_num(r, "fps", "%f",
+            (cur->conn_frame_count[last] - prev->conn_frame_count[last])
+            / dt);
+    record_num(r, "Bps", "%e",
+            (cur->conn_total_bytes[last] - prev->conn_total_bytes[last])
+            / dt);
+    r->prefix = NULL;
+    r->absent = 0;
+    record_end(r);
+}
+
+/*
+ * Reports the rates between the snapshots @prev and @cur, taken during the
+ * measurement window which started at @begin.
+ */
+static void report_sample(const struct bench_run_options * const opts,
+        const struct bench_config * const cfg,
+        const struct bench_result * const res,
+        const struct snapshot * const begin,
+        const struct snapshot * const prev, const struct snapshot * const cur)
+{
+    static _Bool is_header_written = 0;
+    const double dt = cur->time - prev->time;
+    const double t = cur->time - begin->time;
+    const int dest = dest_stage(cfg), last = dest_hop(cfg);
+    struct record r = {
+        .fp = opts->samples_fp,
+        .format = opts->format,
+    };
+
+    if (opts->samples_fp == NULL || opts->format == BENCH_FORMAT_TEXT) {
+        FILE * const fp = opts->samples_fp == NULL
+                ? stderr : opts->samples_fp;
+        char tag[32] = "";
+        if (cfg->n_instances > 1)
+            snprintf(tag, sizeof(tag), "instance%d: ", cfg->instance);
+        if (res->stages[0].has_stats)
+            fprintf(fp, "sample: %f: %ssource: %f [frame/s] %e [B/s] "
+                    "skipped %u discarded %u\n", t, tag,
+                    (cur->stats[0].frame_count - prev->stats[0].frame_count)
+                    / dt,
+                    (cur->stats[0].total_bytes - prev->stats[0].total_bytes)
+                    / dt,
+                    cur->stats[0].frames_skipped
+                    - prev->stats[0].frames_skipped,
+                    cur->stats[0].frames_discarded
+                    - prev->stats[0].frames_discarded);
+        if (res->stages[dest].has_stats)
+            fprintf(fp, "sample: %f: %sdest: %f [frame/s] "
+                    "skipped %u discarded %u\n", t, tag,
+                    (cur->stats[dest].frame_count
+                     - prev->stats[dest].frame_count) / dt,
+                    cur->stats[dest].frames_skipped
+                    - prev->stats[dest].frames_skipped,
+                    cur->stats[dest].frames_discarded
+                    - prev->stats[dest].frames_discarded);
+        if (hop_has_ctx(cfg, last))
+            fprintf(fp, "sample: %f: %sconn: %f [frame/s] %e [B/s]\n",
+                    t, tag,
+                    (cur->conn_frame_count[last]
+                     - prev->conn_frame_count[last]) / dt,
+                    (cur->conn_total_bytes[last]
+                     - prev->conn_total_bytes[last]) / dt);
+        fflush(fp);
+        return;
+    }
+    if (opts->format == BENCH_FORMAT_CSV && !is_header_written) {
+        r.header = !0;
+        record_sample(&r, cfg, res, begin, prev, cur);
+        r.header = 0;
+        is_header_written = !0;
+    }
+    record_sample(&r, cfg, res, begin, prev, cur);
+}
+
+/*
+ * A flat JSON object as record_result() writes it.  Values are kept as they
+ * are written, strings unquoted, and %NULL for null.
+ */
+struct bench_flat_record {
+    char **keys, **vals;
+    int n;
+};
+
+/*
+ * Keys of a record which tell its configuration; the other ones are results
+ * or do not change them.
+ */
+static const char * const baseline_keys[] = {
+    "encoding", "width", "height", "target_fps", "source", "pattern", "dest",
+    "conn", "pipeline", "zero_copy", "buffer_num", "buffer_size", "workers",
+    "process", "process_arg", "arena", "bitrate", "profile", "intra_period",
+    "codec", "instances",
+};
+
+static void free_flat_record(struct bench_flat_record * const rec)
+{
+    int i;
+
+    for (i = 0; i < rec->n; i ++) {
+        free(rec->keys[i]);
+        free(rec->vals[i]);
+    }
+    free(rec->keys);
+    free(rec->vals);
+    rec->keys = rec->vals = NULL;
+    rec->n = 0;
+}
+
+/*
+ * Unquotes the JSON string at *@p into *@str, to be freed, and advances *@p
+ * past it.
+ *
+ * Return: 0 on success, -EINVAL if it is not terminated, or -ENOMEM.
+ */
+static int parse_json_str(const char ** const p, char ** const str)
+{
+    const char *s = *p + 1;
+    char *d = malloc(strlen(s) + 1);
+
+    if (d == NULL) {
+        print_error("Failed to allocate a string\n");
+        return -ENOMEM;
+    }
+    *str = d;
+    for (; *s != '"'; s ++) {
+        if (*s == '\\')
+            s ++;
+        if (*s == '\0') {
+            free(*str);
+            return -EINVAL;
+        }
+        *d ++ = *s;
+    }
+    *d = '\0';
+    *p = s + 1;
+    return 0;
+}
+
+/*
+ * Parses @line as one object of strings, numbers and nulls into @rec, which
+ * is to be freed with free_flat_record() either way.
+ *
+ * Return: 0 on success, -EINVAL if @line is not such an object, or -ENOMEM.
+ */
+static int parse_flat_record(const char *p,
+        struct bench_flat_record * const rec)
+{
+    *rec = (struct bench_flat_record) {NULL, NULL, 0};
+    p += strspn(p, " \t");
+    if (*p ++ != '{')
+        return -EINVAL;
+    p += strspn(p, " \t");
+    if (*p == '}')
+        return 0;
+    for (;;) {
+        char *key, *val = NULL, **keys, **vals;
+        int ret;
+
+        p += strspn(p, " \t");
+        if (*p != '"')
+            return -EINVAL;
+        ret = parse_json_str(&p, &key);
+        if (ret)
+            return ret;
+        p += strspn(p, " \t");
+        if (*p ++ != ':') {
+            free(key);
+            return -EINVAL;
+        }
+        p += strspn(p, " \t");
+        if (*p == '"') {
+            ret = parse_json_str(&p, &val);
+            if (ret) {
+                free(key);
+                return ret;
+            }
+        } else if (!strncmp(p, "null", 4)) {
+            p += 4;
+        } else {
+            const size_t len = strcspn(p, ",} \t\n");
+            if (len == 0) {
+                free(key);
+                return -EINVAL;
+            }
+            val = strndup(p, len);
+            if (val == NULL) {
+                print_error("Failed to allocate a string\n");
+                free(key);
+                return -ENOMEM;
+            }
+            p += len;
+        }
+        keys = realloc(rec->keys, (rec->n + 1) * sizeof(*keys));
+        if (keys != NULL)
+            rec->keys = keys;
+        vals = realloc(rec->vals, (rec->n + 1) * sizeof(*vals));
+        if (vals != NULL)
+            rec->vals = vals;
+        if (keys == NULL || vals == NULL) {
+            print_error("Failed to allocate a record\n");
+            free(val);
+            free(key);
+            return -ENOMEM;
+        }
+        rec->keys[rec->n] = key;
+        rec->vals[rec->n] = val;
+        rec->n ++;
+        p += strspn(p, " \t");
+        if (*p == '}')
+            return 0;
+        if (*p ++ != ',')
+            return -EINVAL;
+    }
+}
+
+/* Return: The value of @key in @rec, or %NULL if it is null or missing. */
+static const char *flat_get(const struct bench_flat_record * const rec,
+        const char * const key)
+{
+    int i;
+
+    for (i = 0; i < rec->n; i ++)
+        if (!strcmp(rec->keys[i], key))
+            return rec->vals[i];
+    return NULL;
+}
+
+/* Return: 0 and @key of @rec in *@v, or -ENOENT if it is not a number. */
+static int flat_get_num(const struct bench_flat_record * const rec,
+        const char * const key, double * const v)
+{
+    const char * const val = flat_get(rec, key);
+    char *end;
+
+    if (val == NULL)
+        return -ENOENT;
+    *v = strtod(val, &end);
+    return *end == '\0' && end != val ? 0 : -ENOENT;
+}
+
+/* Return: Non-zero if @a and @b are records of the same configuration. */
+static _Bool is_same_config(const struct bench_flat_record * const a,
+        const struct bench_flat_record * const b)
+{
+    unsigned i;
+
+    for (i = 0; i < MMAL_COUNTOF(baseline_keys); i ++) {
+        const char * const va = flat_get(a, baseline_keys[i]);
+        const char * const vb = flat_get(b, baseline_keys[i]);
+        if ((va == NULL) != (vb == NULL)
+                || (va != NULL && strcmp(va, vb)))
+            return 0;
+    }
+    return !0;
+}
+
+/*
+ * Loads the records of @path, one JSON object per line as --format=json
+ * writes them, into @bl.  Blank lines are skipped.
+ *
+ * Return: 0 on success, or <0 if @path cannot be read or has no records, in
+ * which case @bl is left empty.
+ */
+int bench_load_baseline(const char * const path,
+        struct bench_baseline * const bl)
+{
+    FILE * const fp = fopen(path, "r");
+    char *line = NULL;
+    size_t size = 0;
+    int n_lines = 0, ret = 0;
+
+    if (fp == NULL) {
+        ret = -errno;
+        print_error("Failed to open %s: %s\n", path, strerror(-ret));
+        return ret;
+    }
+    while (getline(&line, &size, fp) != -1) {
+        struct bench_flat_record *records;
+        n_lines ++;
+        if (line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+        records = realloc(bl->records, (bl->n + 1) * sizeof(*records));
+        if (records == NULL) {
+            print_error("Failed to allocate the baseline\n");
+            ret = -ENOMEM;
+            break;
+        }
+        bl->records = records;
+        ret = parse_flat_record(line, &bl->records[bl->n]);
+        if (ret) {
+            if (ret == -EINVAL)
+                print_error("%s:%d: Not a JSON record\n", path, n_lines);
+            free_flat_record(&bl->records[bl->n]);
+            break;
+        }
+        bl->n ++;
+    }
+    free(line);
+    fclose(fp);
+    if (ret == 0 && bl->n == 0) {
+        print_error("No records in %s\n", path);
+        ret = -EINVAL;
+    }
+    if (ret) {
+        bench_free_baseline(bl);
+        return ret;
+    }
+    print_info("baseline: %d records from %s\n", bl->n, path);
+    return 0;
+}
+
+/*
+ * Compares @cur with @base, where higher values are better if @is_higher,
+ * and shows how much they differ.
+ *
+ * Return: Non-zero if @cur is worse than @base by more than @threshold.
+ */
+static _Bool check_metric(const char * const name, const char * const unit,
+        const double cur, const double base, const double threshold,
+        const _Bool is_higher)
+{
+    const double change = (cur - base) / base;
+    const _Bool is_regressed = is_higher ? change < -threshold
+            : change > threshold;
+
+    print_info("baseline: %s: %f, baseline %f [%s] (%+.1f%%)%s\n", name, cur,
+            base, unit, change * 100, is_regressed ? ": regressed" : "");
+    return is_regressed;
+}
+
+/*
+ * Compares the means of the trials of a configuration with the ones of its
+ * records in @bl, and counts it in bl->n_failed if it has regressed or it
+ * has no records.  The configuration is told by the JSON record of @res of
+ * @cfg so that it is matched in the same way as it has been written.
+ * @fps, @Bps: Means of the aggregate frame/s and B/s of the trials
+ * @p99:       Mean of the worst p99 latency among the instances [us], or 0
+ *
+ * Return: 0 once compared, or <0 if the record of @res cannot be made.
+ */
+static int check_baseline(struct bench_baseline * const bl,
+        const struct bench_config * const cfg,
+        const struct bench_result * const res, const double fps,
+        const double Bps, const double p99)
+{
+    struct bench_flat_record cur;
+    struct record r = {
+        .format = BENCH_FORMAT_JSON,
+    };
+    char *buf = NULL;
+    size_t size = 0;
+    double base_fps = 0, base_Bps = 0, base_p99 = 0;
+    unsigned n = 0, n_p99 = 0;
+    _Bool is_regressed = 0;
+    int i, j, ret;
+
+    r.fp = open_memstream(&buf, &size);
+    if (r.fp == NULL) {
+        ret = -errno;
+        print_error("Failed to open a memory stream: %s\n", strerror(-ret));
+        return ret;
+    }
+    record_result(&r, cfg, res);
+    fclose(r.fp);
+    ret = parse_flat_record(buf, &cur);
+    free(buf);
+    if (ret) {
+        print_error("Failed to parse the record of the run\n");
+        free_flat_record(&cur);
+        return ret;
+    }
+
+    /* Each trial has its aggregates in instance 0 and p99 in all of them. */
+    for (i = 0; i < bl->n; i ++) {
+        const struct bench_flat_record * const rec = &bl->records[i];
+        double instance, trial, v, trial_p99 = -1;
+        if (!is_same_config(rec, &cur)
+                || flat_get_num(rec, "instance", &instance) || instance != 0
+                || flat_get_num(rec, "trial", &trial))
+            continue;
+        if (flat_get_num(rec, "aggregate_fps", &v) == 0)
+            base_fps += v;
+        if (flat_get_num(rec, "aggregate_Bps", &v) == 0)
+            base_Bps += v;
+        n ++;
+        for (j = 0; j < bl->n; j ++) {
+            const struct bench_flat_record * const other = &bl->records[j];
+            double t;
+            if (is_same_config(other, &cur)
+                    && flat_get_num(other, "trial", &t) == 0 && t == trial
+                    && flat_get_num(other, "latency_p99_us", &v) == 0)
+                trial_p99 = MMAL_MAX(trial_p99, v);
+        }
+        if (trial_p99 >= 0) {
+            base_p99 += trial_p99;
+            n_p99 ++;
+        }
+    }
+    free_flat_record(&cur);
+    if (n == 0) {
+        print_error("baseline: No records of this configuration\n");
+        bl->n_failed ++;
+        return 0;
+    }
+    base_fps /= n;
+    base_Bps /= n;
+    if (base_fps > 0)
+        is_regressed |= check_metric("frame/s", "frame/s", fps, base_fps,
+                bl->threshold, !0);
+    if (base_Bps > 0)
+        is_regressed |= check_metric("B/s", "B/s", Bps, base_Bps,
+                bl->threshold, !0);
+    if (n_p99 > 0 && p99 > 0 && base_p99 > 0)
+        is_regressed |= check_metric("p99 latency", "us", p99,
+                base_p99 / n_p99, bl->threshold, 0);
+    if (is_regressed) {
+        print_error("baseline: The configuration above regressed\n");
+        bl->n_failed ++;
+    }
+    return 0;
+}
+
+/*
+ * Applies the buffer_num and buffer_size of @cfg to both ends of a connection.
+ * Ones which are not given are set to the recommended values so that the
+ * connection can be created with MMAL_CONNECTION_FLAG_KEEP_BUFFER_REQUIREMENTS.
+ *
+ * Return: 0 on success, or -EINVAL if the ports cannot take the values.
+ */
+static int setup_buffers(const struct bench_config * const cfg,
+        MMAL_PORT_T * const out, MMAL_PORT_T * const in)
+{
+    const unsigned num_min = MMAL_MAX(out->buffer_num_min, in->buffer_num_min);
+    const unsigned size_min = MMAL_MAX(out->buffer_size_min,
+            in->buffer_size_min);
+    unsigned num = cfg->buffer_num, size = cfg->buffer_size;
+
+    if (num == 0)
+        num = MMAL_MAX(MMAL_MAX(out->buffer_num_recommended,
+                    in->buffer_num_recommended), num_min);
+    if (size == 0)
+        size = MMAL_MAX(MMAL_MAX(out->buffer_size_recommended,
+                    in->buffer_size_recommended), size_min);
+    if (num < num_min) {
+        print_error("buffer_num must be >= %u\n", num_min);
+        return -EINVAL;
+    }
+    if (size < size_min) {
+        print_error("buffer_size must be >= %u\n", size_min);
+        return -EINVAL;
+    }
+    out->buffer_num = in->buffer_num = num;
+    out->buffer_size = in->buffer_size = size;
+    return 0;
+}
+
+/*
+ * Sets up what is kept across runs on @cp, the new component of @stage.
+ *
+ * Return: 0 on success, or -EIO.
+ */
+static int stage_init(const struct bench_config * const cfg,
+        const struct bench_stage_config * const stage,
+        MMAL_COMPONENT_T * const cp)
+{
+    {
+        MMAL_PORT_T *port = mmal_util_get_port(cp, MMAL_PORT_TYPE_CONTROL, 0);
+        try_mmal(mmal_port_enable(port, cb_control));
+    }
+    if (stage->kind != BENCH_STAGE_SOURCE)
+        return 0;
+    switch (stage->type) {
+        case BENCH_SOURCE_SOURCE:
+            {
+                MMAL_PORT_T *port = mmal_util_get_port(cp,
+                        MMAL_PORT_TYPE_OUTPUT, cfg->source_output_port);
+                MMAL_PARAMETER_VIDEO_SOURCE_PATTERN_T param = {
+                    .hdr = {
+                        .id = MMAL_PARAMETER_VIDEO_SOURCE_PATTERN,
+                        .size = sizeof(param),
+                    },
+                    .pattern = pattern_to_mmal[cfg->pattern],
+                };
+                try_mmal(mmal_port_parameter_set(port, &param.hdr));
+            }
+            break;
+        case BENCH_SOURCE_CAMERA:
+            {
+                if (cfg->camera_num >= 0) {
+                    print_info("Setting camera_num to %d\n",
+                            cfg->camera_num);
+                    try_mmal(mmal_port_parameter_set_int32(cp->control,
+                                MMAL_PARAMETER_CAMERA_NUM, cfg->camera_num));
+                }
+            }
+            break;
+    }
+    return 0;
+}
+
+/*
+ * Creates the component of stage @i and sets up what is kept across runs.
+ *
+ * Return: 0 on success, or -EIO, in which case b->cp[@i] is left %NULL.
+ */
+static int stage_create(struct bench * const b,
+        const struct bench_config * const cfg, const int i)
+{
+    const struct bench_stage_config * const stage = &cfg->stages[i];
+    const double start = get_time();
+    MMAL_COMPONENT_T *cp;
+    int ret;
+
+    try_mmal(mmal_component_create(stage_to_mmal(stage), &cp));
+    b->times.component_create += get_time() - start;
+    ret = stage_init(cfg, stage, cp);
+    if (ret) {
+        mmal_component_destroy(cp);
+        return ret;
+    }
+    b->cp[i] = cp;
+    b->stages[i] = *stage;
+    return 0;
+}
+
+static void *arena_alloc(void *context, uint32_t size)
+{
+    struct pool_arena * const a = context;
+
+    if (size > a->slot_size || a->n_free == 0) {
+        print_error("Arena cannot take a payload of %u bytes\n", size);
+        return NULL;
+    }
+    return a->base + a->free_slots[-- a->n_free] * a->slot_size;
+}
+
+static void arena_free(void *context, void *mem)
+{
+    struct pool_arena * const a = context;
+
+    a->free_slots[a->n_free ++] = ((uint8_t *) mem - a->base) / a->slot_size;
+}
+
+/*
+ * Maps @a for @n_slots payloads of @size bytes as in @kind, with all its
+ * pages faulted in.
+ *
+ * Return: 0 on success, or -ENOMEM if it cannot be mapped, as when no huge
+ * page is reserved.
+ */
+static int arena_create(struct pool_arena * const a,
+        const enum bench_arena kind, const unsigned n_slots, const size_t size)
+{
+    /* Page-aligned slots, which the huge pages line up with as well */
+    const size_t slot_size = VCOS_ALIGN_UP(size, 4096);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+    unsigned i;
+    void *p;
+
+    if (kind == BENCH_ARENA_HUGEPAGE)
+        flags |= MAP_HUGETLB;
+    a->size = slot_size * n_slots;
+    if (kind == BENCH_ARENA_HUGEPAGE)
+        a->size = VCOS_ALIGN_UP(a->size, 2 << 20);
+    p = mmap(NULL, a->size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED) {
+        print_error("Failed to map a %s arena of %zu bytes: %s\n",
+                bench_arena_table[kind], a->size, strerror(errno));
+        return -ENOMEM;
+    }
+    a->free_slots = malloc(n_slots * sizeof(*a->free_slots));
+    if (a->free_slots == NULL) {
+        print_error("Failed to allocate the slots of an arena\n");
+        munmap(p, a->size);
+        return -ENOMEM;
+    }
+    a->base = p;
+    a->slot_size = slot_size;
+    a->n_slots = a->n_free = n_slots;
+    for (i = 0; i < n_slots; i ++)
+        a->free_slots[i] = n_slots - 1 - i;
+    return 0;
+}
+
+static void arena_destroy(struct pool_arena * const a)
+{
+    if (a->base == NULL)
+        return;
+    if (munmap(a->base, a->size) == -1)
+        print_error("Failed to unmap an arena: %s\n", strerror(errno));
+    free(a->free_slots);
+    a->base = NULL;
+}
+
+/*
+ * Pool callback of a connection whose pool is on an arena, doing what
+ * mmal_connection_create() has the callback of its own pool do.
+ */
+static MMAL_BOOL_T cb_arena_release(MMAL_POOL_T *pool,
+        MMAL_BUFFER_HEADER_T *buffer, void *userdata)
+{
+    MMAL_CONNECTION_T * const conn = userdata;
+
+    mmal_queue_put(pool->queue, buffer);
+    if (conn->is_enabled && conn->callback != NULL)
+        conn->callback(conn);
+    return MMAL_FALSE;
+}
+
+/*
+ * Replaces the pool which mmal_connection_create() has allocated for @conn
+ * with one of the same size on @a, which is created as in @kind.  @conn must
+ * keep its buffer requirements, as set by setup_buffers(), so that the pool
+ * is not resized past the arena when it is enabled.
+ *
+ * Return: 0 on success, or <0 if the arena or the pool cannot be created, in
+ * which case @conn keeps its pool.
+ */
+static int conn_use_arena(MMAL_CONNECTION_T * const conn,
+        struct pool_arena * const a, const enum bench_arena kind)
+{
+    MMAL_PORT_T * const port = conn->out;
+    const int ret = arena_create(a, kind, port->buffer_num * 2,
+            port->buffer_size);
+    MMAL_POOL_T *pool;
+
+    if (ret)
+        return ret;
+    pool = mmal_pool_create_with_allocator(port->buffer_num,
+            port->buffer_size, a, arena_alloc, arena_free);
+    if (pool == NULL) {
+        print_error("Failed to create a pool on the arena\n");
+        arena_destroy(a);
+        return -ENOMEM;
+    }
+    mmal_port_pool_destroy(port, conn->pool);
+    conn->pool = pool;
+    mmal_pool_callback_set(conn->pool, cb_arena_release, conn);
+    return 0;
+}
+
+/*
+ * Destroys the connections which bench_start() has created so far.  One
+ * which fails to be destroyed is reported and left, with its arena.
+ */
+static void bench_destroy_conns(struct bench_run * const run)
+{
+    int i;
+
+    for (i = run->n_created - 1; i >= 0; i --) {
+        if (run->conns[i] != NULL) {
+            const MMAL_STATUS_T err = mmal_connection_destroy(run->conns[i]);
+            if (err != MMAL_SUCCESS) {
+                print_error("Failed to destroy connection %d: %s\n", i,
+                        mmal_status_to_string(err));
+                continue;
+            }
+        }
+        /* After the pool on it has been freed with the connection */
+        arena_destroy(&run->arenas[i]);
+    }
+    run->n_created = 0;
+}
+
+/*
+ * Enables @port as the one of @ep, which feeds ep->data to it in a loop, or
+ * drains it if that is %NULL.  The pool is allocated on the first call after
+ * bench_disconnect() and @ep counts from 0 then.
+ *
+ * Return: 0 on success, or <0, in which case @port is left disabled and what
+ * has been allocated is left to endpoint_destroy().
+ */
+static int endpoint_enable(struct endpoint * const ep,
+        MMAL_PORT_T * const port)
+{
+    if (ep->pool == NULL) {
+        MMAL_POOL_T *pool;
+        port->buffer_num = MMAL_MAX(port->buffer_num_recommended,
+                port->buffer_num_min);
+        port->buffer_size = MMAL_MAX(MMAL_MAX(port->buffer_size_recommended,
+                    port->buffer_size_min), ep->frame_size);
+        pool = mmal_port_pool_create(port, port->buffer_num,
+                ep->by_reference ? 0 : port->buffer_size);
+        if (pool == NULL) {
+            print_error("Failed to create the pool of %s\n", port->name);
+            return -ENOMEM;
+        }
+        if (vcos_mutex_create(&ep->lock, "endpoint") != VCOS_SUCCESS) {
+            print_error("Failed to create the lock of %s\n", port->name);
+            mmal_port_pool_destroy(port, pool);
+            return -EIO;
+        }
+        ep->pool = pool;
+        ep->port = port;
+        ep->offset = 0;
+        memset(&ep->stats, 0, sizeof(ep->stats));
+        if (ep->sink_path[0] != '\0') {
+            ep->writer = writer_create(ep->sink_path, port->buffer_size);
+            if (ep->writer == NULL)
+                return -EIO;
+        }
+    }
+    port->userdata = (struct MMAL_PORT_USERDATA_T *) ep;
+    try_mmal(mmal_port_enable(port, cb_endpoint));
+    vcos_mutex_lock(&ep->lock);
+    ep->running = !0;
+    endpoint_refill(ep);
+    vcos_mutex_unlock(&ep->lock);
+    return 0;
+}
+
+static void endpoint_disable(struct endpoint * const ep)
+{
+    MMAL_STATUS_T err;
+
+    if (ep->pool == NULL || !ep->port->is_enabled)
+        return;
+    vcos_mutex_lock(&ep->lock);
+    ep->running = 0;
+    vcos_mutex_unlock(&ep->lock);
+    err = mmal_port_disable(ep->port);
+    if (err != MMAL_SUCCESS)
+        print_error("Failed to disable %s: %s\n", ep->port->name,
+                mmal_status_to_string(err));
+}
+
+static void endpoint_destroy(struct endpoint * const ep)
+{
+    if (ep->pool == NULL)
+        return;
+    endpoint_disable(ep);
+    if (ep->writer != NULL) {
+        writer_destroy(ep->writer, ep->sink_path);
+        ep->writer = NULL;
+    }
+    mmal_port_pool_destroy(ep->port, ep->pool);
+    ep->pool = NULL;
+    vcos_mutex_delete(&ep->lock);
+}
+
+/*
+ * Enables or disables the endpoints of the stages of @kind: the sources are
+ * fed from cfg->stream or b->frames and the dests are drained.
+ *
+ * Return: 0 on success, or <0 if an endpoint cannot be enabled, in which
+ * case the ones before it are left enabled.
+ */
+static int bench_endpoints(struct bench * const b,
+        const struct bench_config * const cfg, const enum bench_stage_kind kind,
+        const _Bool enable)
+{
+    int i, ret;
+
+    for (i = 0; i < cfg->n_stages; i ++) {
+        MMAL_PORT_T * const port = stage_endpoint(b, cfg, i);
+        struct endpoint * const ep = &b->endpoints[i];
+        if (port == NULL || cfg->stages[i].kind != kind)
+            continue;
+        if (!enable) {
+            endpoint_disable(ep);
+            continue;
+        }
+        if (ep->pool == NULL) {
+            ep->data = NULL;
+            ep->size = ep->frame_size = 0;
+            ep->by_reference = 0;
+            ep->sink_path[0] = '\0';
+        }
+        if (ep->pool == NULL && cfg->stages[i].type == BENCH_SOURCE_DECODE
+                && kind == BENCH_STAGE_SOURCE) {
+            ep->data = cfg->stream;
+            ep->size = cfg->stream_size;
+        } else if (ep->pool == NULL && cfg->stages[i].type == BENCH_SOURCE_FILE
+                && kind == BENCH_STAGE_SOURCE) {
+            ep->data = b->frames;
+            ep->size = b->frames_size;
+            ep->frame_size = frame_bytes(encoding_to_mmal[cfg->encoding],
+                    cfg->width, cfg->height);
+            ep->by_reference = !cfg->zero_copy;
+            try_mmal(mmal_port_parameter_set_boolean(port,
+                    MMAL_PARAMETER_ZERO_COPY, cfg->zero_copy));
+        } else if (ep->pool == NULL && cfg->stages[i].type == BENCH_DEST_FILE
+                && kind == BENCH_STAGE_DEST) {
+            /* Each instance gets a file of its own. */
+            if (cfg->n_instances > 1)
+                snprintf(ep->sink_path, sizeof(ep->sink_path), "%s.%d",
+                        cfg->sink_path, cfg->instance);
+            else
+                snprintf(ep->sink_path, sizeof(ep->sink_path), "%s",
+                        cfg->sink_path);
+            try_mmal(mmal_port_parameter_set_boolean(port,
+                    MMAL_PARAMETER_ZERO_COPY, cfg->zero_copy));
+        }
+        ret = endpoint_enable(ep, port);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/*
+ * Stops the pump threads of b->run and destroys its connections, if it is
+ * connected.  The connections must be disabled by bench_stop() beforehand.
+ */
+static void bench_disconnect(struct bench * const b)
+{
+    struct bench_run * const run = &b->run;
+    int i, j;
+
+    for (i = 0; i < run->n_created; i ++) {
+        struct conn_ctx * const ctx = &run->conn_ctx[i];
+        if (run->ctxs[i] == NULL)
+            continue;
+        if (ctx->conn == BENCH_CONN_QUEUE) {
+            ctx->stop = !0;
+            for (j = 0; j < ctx->n_workers; j ++)
+                vcos_semaphore_post(&ctx->sem);
+            for (j = 0; j < ctx->n_workers; j ++)
+                vcos_thread_join(&ctx->workers[j].thread, NULL);
+            vcos_semaphore_delete(&ctx->sem);
+        }
+        vcos_mutex_delete(&ctx->lock);
+        free(ctx->stamps);
+        free(ctx->scratch);
+    }
+    bench_destroy_conns(run);
+    for (i = 0; i < b->n_stages; i ++)
+        endpoint_destroy(&b->endpoints[i]);
+}
+
+/*
+ * Asks the source for cfg->fps through @port: in the format before it is
+ * committed, and then, with @is_committed, through the parameters, that is
+ * MMAL_PARAMETER_VIDEO_FRAME_RATE for vc.ril.source and
+ * MMAL_PARAMETER_FPS_RANGE pinned to cfg->fps for the camera.
+ *
+ * Return: 0 on success, or -EIO.
+ */
+static int setup_frame_rate(const struct bench_config * const cfg,
+        MMAL_PORT_T * const port, const _Bool is_committed)
+{
+    const MMAL_RATIONAL_T rate = {
+        .num = (int32_t) lround(cfg->fps * 1000),
+        .den = 1000,
+    };
+
+    if (cfg->fps <= 0)
+        return 0;
+    if (!is_committed) {
+        port->format->es->video.frame_rate = rate;
+        return 0;
+    }
+    switch (cfg->source) {
+        case BENCH_SOURCE_SOURCE:
+            {
+                MMAL_PARAMETER_FRAME_RATE_T param = {
+                    .hdr = {
+                        .id = MMAL_PARAMETER_VIDEO_FRAME_RATE,
+                        .size = sizeof(param),
+                    },
+                    .frame_rate = rate,
+                };
+                try_mmal(mmal_port_parameter_set(port, &param.hdr));
+            }
+            break;
+        case BENCH_SOURCE_CAMERA:
+            {
+                MMAL_PARAMETER_FPS_RANGE_T param = {
+                    .hdr = {
+                        .id = MMAL_PARAMETER_FPS_RANGE,
+                        .size = sizeof(param),
+                    },
+                    .fps_low = rate,
+                    .fps_high = rate,
+                };
+                try_mmal(mmal_port_parameter_set(port, &param.hdr));
+            }
+            break;
+        case BENCH_SOURCE_DECODE:
+        case BENCH_SOURCE_FILE:
+            /* They are fed as fast as they are consumed. */
+            break;
+    }
+    return 0;
+}
+
+/*
+ * Sets the input of BENCH_SOURCE_DECODE to take cfg->stream.  The decoded
+ * frames are expected to be of the size of @cfg.
+ *
+ * Return: 0 on success, or -EIO.
+ */
+static int setup_decoder(const struct bench_config * const cfg,
+        MMAL_PORT_T * const port)
+{
+    port->format->type = MMAL_ES_TYPE_VIDEO;
+    port->format->encoding = codec_to_mmal[cfg->codec];
+    port->format->encoding_variant = 0;
+    port->format->es->video.width = VCOS_ALIGN_UP(cfg->width, 32);
+    port->format->es->video.height = VCOS_ALIGN_UP(cfg->height, 16);
+    port->format->es->video.crop.x = 0;
+    port->format->es->video.crop.y = 0;
+    port->format->es->video.crop.width = cfg->width;
+    port->format->es->video.crop.height = cfg->height;
+    port->format->es->video.frame_rate.num = 0;
+    port->format->es->video.frame_rate.den = 1;
+    /* The stream is fed in chunks which do not follow the frames. */
+    port->format->flags = 0;
+    try_mmal(mmal_port_format_commit(port));
+    return 0;
+}
+
+/*
+ * Sets the output of the encoder dest @cp of @type to its encoding, taking
+ * the rest of the format from the input, and applies the bit rate, the
+ * profile and the intra period of @cfg.
+ *
+ * Return: 0 on success, or -EIO.
+ */
+static int setup_encoder(const struct bench_config * const cfg,
+        MMAL_COMPONENT_T * const cp, const enum bench_dest type)
+{
+    MMAL_PORT_T * const port = cp->output[0];
+
+    mmal_format_copy(port->format, cp->input[0]->format);
+    port->format->encoding = dest_to_encoding[type];
+    port->format->encoding_variant = 0;
+    if (type != BENCH_DEST_JPEG)
+        port->format->bitrate = cfg->bitrate;
+    try_mmal(mmal_port_format_commit(port));
+    if (type == BENCH_DEST_H264 && cfg->profile >= 0) {
+        MMAL_PARAMETER_VIDEO_PROFILE_T param = {
+            .hdr = {
+                .id = MMAL_PARAMETER_PROFILE,
+                .size = sizeof(param),
+            },
+            .profile = {
+                {
+                    .profile = profile_to_mmal[cfg->profile],
+                    .level = MMAL_VIDEO_LEVEL_H264_4,
+                },
+            },
+        };
+        try_mmal(mmal_port_parameter_set(port, &param.hdr));
+    }
+    if (type != BENCH_DEST_JPEG && cfg->intra_period > 0)
+        try_mmal(mmal_port_parameter_set_uint32(port,
+                MMAL_PARAMETER_INTRAPERIOD, cfg->intra_period));
+    return 0;
+}
+
+/*
+ * Copies a row of @len bytes from @src to @dst @n_rows times, advancing by
+ * @len in @src and by @stride in @dst.
+ */
+static void copy_rows(uint8_t *dst, const size_t stride, const uint8_t *src,
+        const size_t len, const int n_rows)
+{
+    int i;
+
+    for (i = 0; i < n_rows; i ++, dst += stride, src += len)
+        memcpy(dst, src, len);
+}
+
+/*
+ * Lays out the frame at @src, packed as in a raw clip, at @dst as
+ * config_port() has the port take it, i.e. with each plane padded as in
+ * frame_bytes().
+ */
+static void repack_frame(const MMAL_FOURCC_T encoding, const int width,
+        const int height, uint8_t * const dst, const uint8_t * const src)
+{
+    const size_t stride = mmal_encoding_width_to_stride(encoding,
+            VCOS_ALIGN_UP(width, 32));
+    const size_t rows = VCOS_ALIGN_UP(height, 16);
+    const size_t len = mmal_encoding_width_to_stride(encoding, width);
+    uint8_t * const dst_c = dst + stride * rows;
+    const uint8_t * const src_c = src + len * height;
+
+    copy_rows(dst, stride, src, len, height);
+    if (!is_planar_420(encoding))
+        return;
+    if (encoding == MMAL_ENCODING_NV12) {
+        copy_rows(dst_c, stride, src_c, len, height / 2);
+        return;
+    }
+    copy_rows(dst_c, stride / 2, src_c, len / 2, height / 2);
+    copy_rows(dst_c + stride / 2 * rows / 2, stride / 2,
+            src_c + len / 2 * height / 2, len / 2, height / 2);
+}
+
+/*
+ * Sets b->frames to the frames of cfg->stream for BENCH_SOURCE_FILE, repacking
+ * them into b->repacked if the size of @cfg needs padding, so that the run
+ * only has to point the buffers at them.
+ *
+ * Return: 0 on success, -EINVAL if the clip has no frame, or -ENOMEM.
+ */
+static int prepare_frames(struct bench * const b,
+        const struct bench_config * const cfg)
+{
+    const MMAL_FOURCC_T encoding = encoding_to_mmal[cfg->encoding];
+    const size_t padded = frame_bytes(encoding, cfg->width, cfg->height);
+    const size_t packed = frame_effective_bytes(encoding, cfg->width,
+            cfg->height);
+    const size_t n_frames = packed == 0 ? 0 : cfg->stream_size / packed;
+    size_t i;
+
+    free(b->repacked);
+    b->repacked = NULL;
+    if (n_frames == 0) {
+        print_error("%s has no frame of %s %dx%d\n", cfg->stream_path,
+                bench_encoding_table[cfg->encoding], cfg->width, cfg->height);
+        return -EINVAL;
+    }
+    print_info("Feeding %zu frames of %s\n", n_frames, cfg->stream_path);
+    b->frames_size = n_frames * padded;
+    if (padded == packed) {
+        b->frames = cfg->stream;
+        return 0;
+    }
+    b->repacked = calloc(n_frames, padded);
+    if (b->repacked == NULL) {
+        print_error("Failed to allocate the repacked frames\n");
+        return -ENOMEM;
+    }
+    for (i = 0; i < n_frames; i ++)
+        repack_frame(encoding, cfg->width, cfg->height,
+                b->repacked + i * padded, cfg->stream + i * packed);
+    b->frames = b->repacked;
+    return 0;
+}
+
+/* Destroys the component of stage @i; a failure is reported and let go. */
+static void stage_destroy(struct bench * const b, const int i)
+{
+    const double start = get_time();
+    const MMAL_STATUS_T err = mmal_component_destroy(b->cp[i]);
+
+    if (err != MMAL_SUCCESS)
+        print_error("Failed to destroy %s: %s\n", b->cp[i]->name,
+                mmal_status_to_string(err));
+    b->times.component_destroy += get_time() - start;
+    b->cp[i] = NULL;
+}
+
+/*
+ * Makes sure that b->cp[] are the components of the stages of @cfg and that
+ * their ports are configured for it.  A component which is the same as in the
+ * previous call at the same stage is reused; only the port formats are
+ * committed again.  A hop from the file source straight into the file dest
+ * has no port for either endpoint, and is refused.
+ *
+ * Return: 0 on success, or <0 if @cfg cannot be set up, in which case the
+ * components are left for the next call or bench_teardown().
+ */
+static int bench_setup(struct bench * const b,
+        const struct bench_config * const cfg)
+{
+    const MMAL_FOURCC_T encoding_mmal = encoding_to_mmal[cfg->encoding];
+    int i, j, ret;
+
+    for (i = 0; i < cfg->n_hops; i ++) {
+        if (stage_has_component(&cfg->stages[cfg->hops[i].from])
+                || stage_has_component(&cfg->stages[cfg->hops[i].to]))
+            continue;
+        print_error("Hop %d has a file at both ends\n", i);
+        return -EINVAL;
+    }
+    /* The ports cannot be reconfigured while they are connected. */
+    bench_disconnect(b);
+    for (i = 0; i < b->n_stages; i ++) {
+        if (b->cp[i] == NULL)
+            continue;
+        if (i < cfg->n_stages && b->stages[i].kind == cfg->stages[i].kind
+                && b->stages[i].type == cfg->stages[i].type)
+            continue;
+        stage_destroy(b, i);
+    }
+    b->n_stages = cfg->n_stages;
+
+    for (i = 0; i < cfg->n_stages; i ++) {
+        if (!stage_has_component(&cfg->stages[i])) {
+            if (cfg->stages[i].kind == BENCH_STAGE_SOURCE) {
+                ret = prepare_frames(b, cfg);
+                if (ret)
+                    return ret;
+            }
+            continue;
+        }
+        if (b->cp[i] == NULL) {
+            ret = stage_create(b, cfg, i);
+            if (ret)
+                return ret;
+        } else
+            try_mmal(mmal_component_disable(b->cp[i]));
+        if (cfg->stages[i].kind != BENCH_STAGE_SOURCE) {
+            MMAL_PORT_T *port = mmal_util_get_port(b->cp[i],
+                    MMAL_PORT_TYPE_INPUT, 0);
+            const double start = get_time();
+            config_port(port, encoding_mmal, cfg->width, cfg->height);
+            if (stage_endpoint(b, cfg, i) != NULL) {
+                ret = setup_encoder(cfg, b->cp[i],
+                        (enum bench_dest) cfg->stages[i].type);
+                if (ret)
+                    return ret;
+            }
+            b->times.format_commit += get_time() - start;
+        } else if (stage_endpoint(b, cfg, i) != NULL) {
+            const double start = get_time();
+            ret = setup_decoder(cfg, b->cp[i]->input[0]);
+            if (ret)
+                return ret;
+            b->times.format_commit += get_time() - start;
+        }
+        for (j = 0; j < cfg->n_hops; j ++) {
+            MMAL_PORT_T *port;
+            double start;
+            if (cfg->hops[j].from != i)
+                continue;
+            port = mmal_util_get_port(b->cp[i], MMAL_PORT_TYPE_OUTPUT,
+                    cfg->hops[j].port);
+            if (cfg->stages[i].kind == BENCH_STAGE_SOURCE)
+                setup_frame_rate(cfg, port, 0);
+            start = get_time();
+            config_port(port, encoding_mmal, cfg->width, cfg->height);
+            b->times.format_commit += get_time() - start;
+            if (cfg->stages[i].kind == BENCH_STAGE_SOURCE) {
+                ret = setup_frame_rate(cfg, port, !0);
+                if (ret)
+                    return ret;
+            }
+        }
+        try_mmal(mmal_component_enable(b->cp[i]));
+    }
+    return 0;
+}
+
+/*
+ * Destroys the components and reports how long it took, as there is no
+ * result to put it in.
+ */
+static void bench_teardown(struct bench * const b)
+{
+    int i;
+
+    bench_disconnect(b);
+    if (b->n_stages == 0)
+        return;
+    memset(&b->times, 0, sizeof(b->times));
+    for (i = b->n_stages - 1; i >= 0; i --)
+        if (b->cp[i] != NULL)
+            stage_destroy(b, i);
+    b->n_stages = 0;
+    free(b->repacked);
+    b->repacked = NULL;
+    print_info("teardown: component_destroy: %f [ms]\n",
+            b->times.component_destroy * 1e3);
+}
+
+/*
+ * Return: get_time() minus the VideoCore STC read through @port [s], or 0
+ * if it cannot be read.  The STC is read between two get_time() calls and
+ * taken to be at their middle.
+ */
+static double stc_offset(MMAL_PORT_T * const port)
+{
+    uint64_t stc;
+    double t0, t1;
+
+    t0 = get_time();
+    if (mmal_port_parameter_get_uint64(port, MMAL_PARAMETER_SYSTEM_TIME,
+                &stc) != MMAL_SUCCESS)
+        return 0;
+    t1 = get_time();
+    return (t0 + t1) / 2 - stc * 1e-6;
+}
+
+/*
+ * Sets @running of every ARM-side hop, and resets the latencies and the
+ * intervals if it is set.
+ */
+static void bench_set_running(const struct bench_config * const cfg,
+        struct bench_run * const run, const _Bool running)
+{
+    int i;
+
+    for (i = 0; i < cfg->n_hops; i ++) {
+        struct conn_ctx * const ctx = run->ctxs[i];
+        if (ctx == NULL)
+            continue;
+        vcos_mutex_lock(&ctx->lock);
+        if (running) {
+            memset(&ctx->latency, 0, sizeof(ctx->latency));
+            memset(&ctx->interval, 0, sizeof(ctx->interval));
+            ctx->last_arrival = 0;
+            memset(&ctx->pts_latency, 0, sizeof(ctx->pts_latency));
+            ctx->pts_unmapped = 0;
+        }
+        ctx->running = running;
+        vcos_mutex_unlock(&ctx->lock);
+    }
+}
+
+/*
+ * Disables the connections of bench_start() once the buffers are no longer
+ * counted, and destroys them unless cfg->reuse is set.  Failures are reported
+ * and the rest is stopped all the same.
+ */
+static void bench_stop(struct bench * const b,
+        const struct bench_config * const cfg,
+        struct bench_result * const res)
+{
+    struct bench_run * const run = &b->run;
+    double start = get_time();
+    MMAL_STATUS_T err;
+    int i;
+
+    /* Upstream first so that no stage is left producing into a sink. */
+    bench_endpoints(b, cfg, BENCH_STAGE_SOURCE, 0);
+    for (i = 0; i < cfg->n_hops; i ++) {
+        if (run->conns[i] == NULL)
+            continue;
+        err = mmal_connection_disable(run->conns[i]);
+        if (err != MMAL_SUCCESS)
+            print_error("Failed to disable connection %d: %s\n", i,
+                    mmal_status_to_string(err));
+    }
+    b->times.connection_disable += get_time() - start;
+    bench_endpoints(b, cfg, BENCH_STAGE_DEST, 0);
+
+    if (run->is_capture) {
+        err = mmal_port_parameter_set_boolean(
+                b->cp[0]->output[cfg->source_output_port],
+                MMAL_PARAMETER_CAPTURE, MMAL_FALSE);
+        if (err != MMAL_SUCCESS)
+            print_error("Failed to stop the capture: %s\n",
+                    mmal_status_to_string(err));
+    }
+
+    for (i = 0; i < cfg->n_hops; i ++) {
+        const struct bench_hop_config * const hop = &cfg->hops[i];
+        MMAL_PORT_T * const port = run->conns[i] != NULL ? run->conns[i]->out
+                : stage_has_component(&cfg->stages[hop->from])
+                ? hop_port_out(b, hop) : hop_port_in(b, hop);
+        res->hops[i].buffer_num = port->buffer_num;
+        res->hops[i].buffer_size = port->buffer_size;
+    }
+    res->setup = b->times;
+    memset(&b->times, 0, sizeof(b->times));
+    if (!cfg->reuse)
+        bench_disconnect(b);
+}
+
+/*
+ * Creates the connection of hop @i into run->conns[@i], or leaves that %NULL
+ * for a hop with an endpoint, and puts its pool on an arena if cfg->arena
+ * is set.
+ *
+ * Return: 0 on success, or <0 if the hop cannot be connected.  What has been
+ * created is left to bench_destroy_conns() either way.
+ */
+static int hop_connect(struct bench * const b,
+        const struct bench_config * const cfg, const int i)
+{
+    struct bench_run * const run = &b->run;
+    const struct bench_hop_config * const hop = &cfg->hops[i];
+    const _Bool is_arena = hop->conn != BENCH_CONN_TUNNEL
+            && cfg->arena != BENCH_ARENA_NONE;
+    MMAL_PORT_T *port_out, *port_in;
+    MMAL_CONNECTION_T *conn;
+    uint32_t conn_flags = 0;
+    double start;
+    int ret;
+
+    run->conns[i] = NULL;
+    if (hop_is_endpoint(cfg, i))
+        return 0;
+    port_out = hop_port_out(b, hop);
+    port_in = hop_port_in(b, hop);
+
+    /*
+     * This must be done before mmal_connection_create, which allocates
+     * the pool with mmal_port_pool_create: with zero copy, the payloads
+     * are then taken from memory shared with VideoCore instead of being
+     * copied.  Always set so that a setting does not leak into the next
+     * run.
+     */
+    try_mmal(mmal_port_parameter_set_boolean(port_out,
+            MMAL_PARAMETER_ZERO_COPY, cfg->zero_copy));
+    try_mmal(mmal_port_parameter_set_boolean(port_in,
+            MMAL_PARAMETER_ZERO_COPY, cfg->zero_copy));
+    if (hop->conn == BENCH_CONN_TUNNEL)
+        conn_flags |= MMAL_CONNECTION_FLAG_TUNNELLING;
+    /*
+     * An arena is sized for the buffers at hand, so they must not be
+     * raised by mmal_connection_enable afterwards.
+     */
+    if (cfg->buffer_num != 0 || cfg->buffer_size != 0 || is_arena)
+        conn_flags |= MMAL_CONNECTION_FLAG_KEEP_BUFFER_REQUIREMENTS;
+    start = get_time();
+    try_mmal(mmal_connection_create(&conn, port_out, port_in, conn_flags));
+    b->times.connection_create += get_time() - start;
+    run->conns[i] = conn;
+    if (conn_flags & MMAL_CONNECTION_FLAG_KEEP_BUFFER_REQUIREMENTS) {
+        ret = setup_buffers(cfg, port_out, port_in);
+        if (ret)
+            return ret;
+    }
+    if (is_arena) {
+        start = get_time();
+        ret = conn_use_arena(conn, &run->arenas[i], cfg->arena);
+        b->times.arena_alloc += get_time() - start;
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/*
+ * Sets up the ARM side of hop @i as connected by hop_connect(): its conn_ctx,
+ * which run->ctxs[@i] points to once its lock is created, and the pump
+ * threads of a BENCH_CONN_QUEUE hop.
+ *
+ * Return: 0 on success, or -EIO.  What has been set up is left to
+ * bench_disconnect() either way.
+ */
+static int hop_setup_ctx(struct bench_run * const run,
+        const struct bench_config * const cfg, const int i)
+{
+    const enum bench_conn conn = cfg->hops[i].conn;
+    struct conn_ctx * const ctx = &run->conn_ctx[i];
+    int j;
+
+    if (run->conns[i] == NULL)
+        return 0;
+    *ctx = (struct conn_ctx) {
+        .conn = conn,
+        .delay_usec = cfg->hops[i].delay_usec,
+        .process = cfg->process,
+        .process_arg = cfg->process_arg,
+    };
+    run->conns[i]->user_data = ctx;
+    run->conns[i]->callback = cb_conn;
+    if (conn == BENCH_CONN_TUNNEL)
+        return 0;
+    try_vcos(vcos_mutex_create(&ctx->lock, "conn_ctx"));
+    if (conn == BENCH_CONN_QUEUE
+            && vcos_semaphore_create(&ctx->sem, "conn_ctx", 0)
+            != VCOS_SUCCESS) {
+        print_error("Failed to create the semaphore of hop %d\n", i);
+        vcos_mutex_delete(&ctx->lock);
+        return -EIO;
+    }
+    run->ctxs[i] = ctx;
+    if (conn != BENCH_CONN_QUEUE)
+        return 0;
+    for (j = 0; j < cfg->workers; j ++) {
+        struct worker * const w = &ctx->workers[j];
+        w->conn = run->conns[i];
+        w->cpu = cfg->n_cpus == 0 ? -1 : cfg->cpus[j % cfg->n_cpus];
+        w->fifo_priority = cfg->fifo_priority;
+        try_vcos(vcos_thread_create(&w->thread, "pump", NULL, pump_thread,
+                w));
+        ctx->n_workers ++;
+    }
+    return 0;
+}
+
+/*
+ * Connects the components set up by bench_setup() as in cfg->hops, unless
+ * they are still connected from the previous trial, and gets the buffers
+ * going.
+ *
+ * Return: 0 on success, or <0 if the configuration cannot be run, in which
+ * case nothing is left to be stopped.
+ */
+static int bench_start(struct bench * const b,
+        const struct bench_config * const cfg,
+        struct bench_result * const res)
+{
+    struct bench_run * const run = &b->run;
+    MMAL_STATUS_T err;
+    double start, offset;
+    int i, ret;
+
+    if (run->n_created != 0)
+        goto enable;
+    for (; run->n_created < cfg->n_hops; run->n_created ++) {
+        ret = hop_connect(b, cfg, run->n_created);
+        if (ret) {
+            run->n_created ++;
+            bench_destroy_conns(run);
+            return ret;
+        }
+    }
+    for (i = 0; i < cfg->n_hops; i ++)
+        run->ctxs[i] = NULL;
+    for (i = 0; i < cfg->n_hops; i ++) {
+        ret = hop_setup_ctx(run, cfg, i);
+        if (ret) {
+            bench_disconnect(b);
+            return ret;
+        }
+    }
+
+enable:
+    /* Known before anything is enabled so that bench_stop() can undo it. */
+    run->is_capture = cfg->source == BENCH_SOURCE_CAMERA
+            && (cfg->source_output_port == 1 || cfg->source_output_port == 2);
+    ret = bench_endpoints(b, cfg, BENCH_STAGE_DEST, !0);
+    if (ret)
+        goto stop;
+    {
+        MMAL_PARAMETER_STATISTICS_T stats;
+        memset(&stats, 0, sizeof(stats));
+        if (stage_has_stats(b, cfg, dest_stage(cfg)))
+            stage_get_stats(b, cfg, dest_stage(cfg), &stats);
+        run->dest_frame_count = stats.frame_count;
+    }
+    for (i = 0; i < cfg->n_hops; i ++)
+        run->conn_ctx[i].first_arrival = 0;
+    /* Downstream first so that no stage produces before its consumer. */
+    start = run->start_time = get_time();
+    for (i = cfg->n_hops - 1; i >= 0; i --) {
+        if (run->conns[i] == NULL)
+            continue;
+        err = mmal_connection_enable(run->conns[i]);
+        if (err != MMAL_SUCCESS) {
+            print_error("Failed to enable connection %d: %s\n", i,
+                    mmal_status_to_string(err));
+            ret = -EIO;
+            goto stop;
+        }
+    }
+    b->times.connection_enable += get_time() - start;
+    offset = stc_offset(b->cp[0] != NULL
+            ? b->cp[0]->output[cfg->source_output_port]
+            : stage_endpoint(b, cfg, 0));
+    for (i = cfg->n_hops - 1; i >= 0; i --) {
+        struct conn_ctx * const ctx = run->ctxs[i];
+        MMAL_POOL_T *pool;
+        unsigned j;
+
+        /* Tunnelled and endpoint hops have no ARM side to get going. */
+        if (ctx == NULL)
+            continue;
+        pool = run->conns[i]->pool;
+        ctx->stc_offset = offset;
+        if (ctx->stamps == NULL)
+            ctx->stamps = calloc(pool->headers_num, sizeof(*ctx->stamps));
+        else
+            memset(ctx->stamps, 0, pool->headers_num * sizeof(*ctx->stamps));
+        if (ctx->stamps == NULL) {
+            print_error("Failed to allocate stamps\n");
+            ret = -ENOMEM;
+            goto stop;
+        }
+        for (j = 0; j < pool->headers_num; j ++)
+            pool->header[j]->user_data = &ctx->stamps[j];
+        ret = ctx_size_scratch(ctx, run->conns[i]->out->buffer_size);
+        if (ret) {
+            print_error("Failed to allocate the memcpy buffer\n");
+            goto stop;
+        }
+
+        /* The pool is filled up by mmal_connection_enable; get it going. */
+        vcos_mutex_lock(&ctx->lock);
+        ctx->running = !0;
+        vcos_mutex_unlock(&ctx->lock);
+        cb_conn(run->conns[i]);
+    }
+    ret = bench_endpoints(b, cfg, BENCH_STAGE_SOURCE, !0);
+    if (ret)
+        goto stop;
+    if (run->is_capture) {
+        print_info("Setting capture to true\n");
+        run->start_time = get_time();
+        err = mmal_port_parameter_set_boolean(
+                b->cp[0]->output[cfg->source_output_port],
+                MMAL_PARAMETER_CAPTURE, MMAL_TRUE);
+        if (err != MMAL_SUCCESS) {
+            print_error("Failed to start the capture: %s\n",
+                    mmal_status_to_string(err));
+            ret = -EIO;
+            goto stop;
+        }
+    }
+    /*
+     * The components may be reused across runs, so the stats of a run are
+     * the difference from the ones at its start.
+     */
+    for (i = 0; i < cfg->n_stages; i ++)
+        res->stages[i].has_stats = stage_has_stats(b, cfg, i);
+    return 0;
+
+stop:
+    bench_set_running(cfg, run, 0);
+    bench_stop(b, cfg, res);
+    return ret;
+}
+
+/* Fills @res with the differences between @begin and @end. */
+static void bench_collect(const struct bench_config * const cfg,
+        const struct bench_run * const run,
+        const struct snapshot * const begin, const struct snapshot * const end,
+        struct bench_result * const res)
+{
+    int i;
+
+    res->elapsed = end->time - begin->time;
+    res->dtlb_misses = begin->dtlb_misses < 0 || end->dtlb_misses < 0 ? -1
+            : end->dtlb_misses - begin->dtlb_misses;
+    sub_cpu_counters(&res->cpu, &end->cpu, &begin->cpu);
+    for (i = 0; i < cfg->n_stages; i ++) {
+        res->stages[i].stats = end->stats[i];
+        sub_stats(&res->stages[i].stats, &begin->stats[i]);
+    }
+    for (i = 0; i < cfg->n_hops; i ++) {
+        struct bench_hop_result * const hop = &res->hops[i];
+        hop->frame_count = end->conn_frame_count[i]
+                - begin->conn_frame_count[i];
+        hop->total_bytes = end->conn_total_bytes[i]
+                - begin->conn_total_bytes[i];
+        hop->process_time = end->conn_process_time[i]
+                - begin->conn_process_time[i];
+        if (run->ctxs[i] != NULL) {
+            hop->latency = run->ctxs[i]->latency;
+            hop->interval = run->ctxs[i]->interval;
+            hop->pts_latency = run->ctxs[i]->pts_latency;
+            hop->pts_unmapped = run->ctxs[i]->pts_unmapped;
+        } else {
+            memset(&hop->latency, 0, sizeof(hop->latency));
+            memset(&hop->interval, 0, sizeof(hop->interval));
+            memset(&hop->pts_latency, 0, sizeof(hop->pts_latency));
+            hop->pts_unmapped = 0;
+        }
+    }
+}
+
+/* Time to wait for the first frame after bench_start() */
+#define TTFF_TIMEOUT_MSEC 5000
+
+/*
+ * Waits for the first frame to reach the dest after bench_start(): it is
+ * seen on the ARM side if the hop into the dest is not tunnelled, or else in
+ * the frame count of the dest if it has one, polled every millisecond.
+ *
+ * Return: Time from b->run.start_time to the first frame [s], or -1 if it
+ * cannot be seen, does not come within TTFF_TIMEOUT_MSEC, or an error event
+ * comes first.
+ */
+static double wait_first_frame(struct bench * const b,
+        const struct bench_config * const cfg,
+        const struct bench_result * const res)
+{
+    struct conn_ctx * const ctx = b->run.ctxs[dest_hop(cfg)];
+    const int dest = dest_stage(cfg);
+    const double start = b->run.start_time;
+
+    if (ctx == NULL && !res->stages[dest].has_stats)
+        return -1;
+    for (; ; ) {
+        if (run_event.error != MMAL_SUCCESS)
+            return -1;
+        if (ctx != NULL) {
+            double t;
+            vcos_mutex_lock(&ctx->lock);
+            t = ctx->first_arrival;
+            vcos_mutex_unlock(&ctx->lock);
+            if (t != 0)
+                return t - start;
+        } else {
+            MMAL_PARAMETER_STATISTICS_T stats;
+            stage_get_stats(b, cfg, dest, &stats);
+            if (stats.frame_count != b->run.dest_frame_count)
+                return get_time() - start;
+        }
+        if (get_time() - start > TTFF_TIMEOUT_MSEC * 1e-3)
+            return -1;
+        sleep_msec(1);
+    }
+}
+
+/*
+ * Interval to poll the dest for -N when no callback counts its frames.  Each
+ * poll is a VCHIQ round trip in the window, so it is coarse, and the run may
+ * go over by up to this much worth of frames.
+ */
+#define FRAMES_POLL_MSEC 100
+
+/*
+ * Sets where the dest of @b stops counting and posts run_event for a -N run,
+ * cfg->frames after the counts in @begin, or clears it if @begin is %NULL.
+ * The frames are counted on the ARM side of the hop into the dest if it is
+ * not tunnelled, or by the endpoint of the dest if it has one.
+ *
+ * Return: Non-zero if neither counts them, so they have to be polled for.
+ */
+static _Bool bench_set_frame_target(struct bench * const b,
+        const struct bench_config * const cfg,
+        const struct snapshot * const begin)
+{
+    const int last = dest_hop(cfg), dest = dest_stage(cfg);
+    struct conn_ctx * const ctx = b->run.ctxs[last];
+    struct endpoint * const ep = &b->endpoints[dest];
+
+    if (ctx != NULL) {
+        vcos_mutex_lock(&ctx->lock);
+        ctx->frame_target = begin == NULL ? 0
+                : begin->conn_frame_count[last] + cfg->frames;
+        if (ctx->frame_target != 0 && ctx->frame_count >= ctx->frame_target) {
+            ctx->running = 0;
+            vcos_semaphore_post(&run_event.sem);
+        }
+        vcos_mutex_unlock(&ctx->lock);
+        return 0;
+    }
+    if (stage_endpoint(b, cfg, dest) != NULL) {
+        vcos_mutex_lock(&ep->lock);
+        ep->frame_target = begin == NULL ? 0
+                : begin->stats[dest].frame_count + cfg->frames;
+        if (ep->frame_target != 0 && ep->stats.frame_count >= ep->frame_target)
+            vcos_semaphore_post(&run_event.sem);
+        vcos_mutex_unlock(&ep->lock);
+        return 0;
+    }
+    return begin != NULL;
+}
+
+/* Return: Frames which have reached the dest of @b since @begin. */
+static unsigned dest_frames_since(struct bench * const b,
+        const struct bench_config * const cfg,
+        const struct snapshot * const begin)
+{
+    const int last = dest_hop(cfg), dest = dest_stage(cfg);
+    struct conn_ctx * const ctx = b->run.ctxs[last];
+    MMAL_PARAMETER_STATISTICS_T stats;
+    unsigned count;
+
+    if (ctx != NULL) {
+        vcos_mutex_lock(&ctx->lock);
+        count = ctx->frame_count - begin->conn_frame_count[last];
+        vcos_mutex_unlock(&ctx->lock);
+        return count;
+    }
+    stage_get_stats(b, cfg, dest, &stats);
+    return stats.frame_count - begin->stats[dest].frame_count;
+}
+
+/*
+ * Waits on run_event until get_time() reaches @until, until every one of the
+ * @n instances @b has had cfg->frames frames into its dest since @begin in a
+ * -N run, or until a component reports an error.  @begin is %NULL before the
+ * window starts, and the dests are polled every FRAMES_POLL_MSEC if
+ * @is_polled is set.
+ *
+ * Return: 0 at @until, 1 once the frames are in, or -EIO on an error event.
+ */
+static int wait_window(struct bench * const b,
+        const struct bench_config * const cfg, const int n,
+        const struct snapshot * const begin, const _Bool is_polled,
+        const double until)
+{
+    for (; ; ) {
+        double left;
+        int k;
+
+        if (run_event.error != MMAL_SUCCESS)
+            return -EIO;
+        if (begin != NULL && cfg->frames != 0) {
+            for (k = 0; k < n && dest_frames_since(&b[k], &cfg[k], &begin[k])
+                    >= (unsigned) cfg[k].frames; k ++)
+                ;
+            if (k == n)
+                return 1;
+        }
+        left = until - get_time();
+        if (left <= 0)
+            return 0;
+        if (is_polled)
+            left = MMAL_MIN(left, FRAMES_POLL_MSEC * 1e-3);
+        /* Timing out is the usual way out. */
+        vcos_semaphore_wait_timeout(&run_event.sem,
+                (VCOS_UNSIGNED) ceil(left * 1e3));
+    }
+}
+
+/*
+ * Starts the @n instances @b, each configured as in @cfg, runs them all
+ * together for cfg->msec milliseconds, or until cfg->frames frames have
+ * reached each dest if it is set, and stops them.  They share one
+ * measurement window.  The time series is sampled every opts->interval_msec
+ * milliseconds if it is set.  An error event from any component ends the
+ * run at once.
+ *
+ * Return: 0 on success, or <0 if an instance cannot be run.  @res is filled
+ * on success only, except res->trial which is set by the caller.
+ */
+static int run_bench(struct bench * const b,
+        const struct bench_config * const cfg, const int n,
+        const struct bench_run_options * const opts,
+        struct bench_result * const res)
+{
+    struct snapshot snap_begin[BENCH_INSTANCE_MAX];
+    struct snapshot snap_end[BENCH_INSTANCE_MAX];
+    struct bench_gpu_state gpu_begin, gpu_during, gpu_end, cur_gpu;
+    _Bool is_polled = 0;
+    int i, k, ret;
+
+    run_event.error = MMAL_SUCCESS;
+    while (vcos_semaphore_trywait(&run_event.sem) == VCOS_SUCCESS)
+        ;
+    for (k = 0; k < n; k ++) {
+        ret = bench_start(&b[k], &cfg[k], &res[k]);
+        if (ret) {
+            while (k -- > 0) {
+                bench_set_running(&cfg[k], &b[k].run, 0);
+                bench_stop(&b[k], &cfg[k], &res[k]);
+            }
+            return ret;
+        }
+    }
+    for (k = 0; k < n; k ++) {
+        if (cfg->frames == 0 || b[k].run.ctxs[dest_hop(&cfg[k])] != NULL
+                || res[k].stages[dest_stage(&cfg[k])].has_stats)
+            continue;
+        print_error("-N needs the frames into the dest to be counted\n");
+        ret = -EINVAL;
+        goto fail;
+    }
+    for (k = 0; k < n; k ++)
+        res[k].ttff = wait_first_frame(&b[k], &cfg[k], &res[k]);
+    if (cfg->warmup_msec > 0) {
+        print_info("Warming up for %d milliseconds\n", cfg->warmup_msec);
+        ret = wait_window(b, cfg, n, NULL, 0,
+                get_time() + cfg->warmup_msec * 1e-3);
+        if (ret)
+            goto fail;
+    }
+
+    /*
+     * The measurement window is from here to the end snapshots below, which
+     * are taken before the connections are disabled.
+     */
+    read_gpu_state(&gpu_begin, !0);
+    for (k = 0; k < n; k ++) {
+        bench_set_running(&cfg[k], &b[k].run, !0);
+        take_snapshot(&snap_begin[k], &b[k], &cfg[k], b[k].run.ctxs, &res[k],
+                !0);
+    }
+    if (cfg->frames != 0) {
+        print_info("Running for %d frames, up to %d milliseconds\n",
+                cfg->frames, cfg->msec);
+        for (k = 0; k < n; k ++)
+            is_polled |= bench_set_frame_target(&b[k], &cfg[k],
+                    &snap_begin[k]);
+    }
+    /*
+     * The GPU is read at least once in the middle of the window, without
+     * the heaps.
+     */
+    gpu_during = gpu_begin;
+    gpu_during.reloc_free_mb = gpu_during.malloc_free_mb = -1;
+    if (opts->interval_msec <= 0) {
+        if (cfg->frames == 0)
+            print_info("Sleeping for %d milliseconds\n", cfg->msec);
+        ret = wait_window(b, cfg, n, snap_begin, is_polled,
+                snap_begin[0].time + cfg->msec * 0.5e-3);
+        read_gpu_state(&cur_gpu, 0);
+        merge_gpu_state(&gpu_during, &cur_gpu);
+        if (ret == 0)
+            ret = wait_window(b, cfg, n, snap_begin, is_polled,
+                    snap_begin[0].time + cfg->msec * 1e-3);
+    } else {
+        const double end = snap_begin[0].time + cfg->msec * 1e-3;
+        struct snapshot prev[BENCH_INSTANCE_MAX], cur;
+        double next = snap_begin[0].time;
+
+        memcpy(prev, snap_begin, n * sizeof(*prev));
+        print_info("Sampling every %d milliseconds for %d milliseconds\n",
+                opts->interval_msec, cfg->msec);
+        for (; ; ) {
+            next += opts->interval_msec * 1e-3;
+            if (next > end)
+                break;
+            ret = wait_window(b, cfg, n, snap_begin, is_polled, next);
+            if (ret)
+                break;
+            read_gpu_state(&cur_gpu, 0);
+            merge_gpu_state(&gpu_during, &cur_gpu);
+            for (k = 0; k < n; k ++) {
+                take_snapshot(&cur, &b[k], &cfg[k], b[k].run.ctxs, &res[k],
+                        0);
+                report_sample(opts, &cfg[k], &res[k], &snap_begin[k],
+                        &prev[k], &cur);
+                prev[k] = cur;
+            }
+        }
+        if (ret == 0)
+            ret = wait_window(b, cfg, n, snap_begin, is_polled, end);
+    }
+    if (ret < 0)
+        goto fail;
+    if (cfg->frames != 0 && ret == 0)
+        print_info("Ran out of time before %d frames\n", cfg->frames);
+    for (k = 0; k < n; k ++) {
+        bench_set_running(&cfg[k], &b[k].run, 0);
+        take_snapshot(&snap_end[k], &b[k], &cfg[k], b[k].run.ctxs, &res[k],
+                !0);
+        bench_set_frame_target(&b[k], &cfg[k], NULL);
+    }
+    /* The stats of the end snapshots may not have been read. */
+    if (run_event.error != MMAL_SUCCESS) {
+        ret = -EIO;
+        goto fail;
+    }
+    read_gpu_state(&gpu_end, !0);
+    for (k = 0; k < n; k ++) {
+        bench_collect(&cfg[k], &b[k].run, &snap_begin[k], &snap_end[k],
+                &res[k]);
+        res[k].gpu_begin = gpu_begin;
+        res[k].gpu_during = gpu_during;
+        res[k].gpu_end = gpu_end;
+        bench_stop(&b[k], &cfg[k], &res[k]);
+    }
+    for (k = 0; k < n; k ++) {
+        res[k].aggregate_fps = res[k].aggregate_Bps = 0;
+        for (i = 0; i < n; i ++) {
+            res[k].aggregate_fps += result_fps(&cfg[i], &res[i]);
+            res[k].aggregate_Bps += result_Bps(&cfg[i], &res[i]);
+        }
+    }
+    return 0;
+
+fail:
+    for (k = 0; k < n; k ++) {
+        bench_set_running(&cfg[k], &b[k].run, 0);
+        bench_set_frame_target(&b[k], &cfg[k], NULL);
+        bench_stop(&b[k], &cfg[k], &res[k]);
+    }
+    return ret;
+}
+
+/* Summary of a set of trials */
+struct summary {
+    unsigned n;
+    double mean, stddev, min, max;
+    /* Half width of the 95% confidence interval of the mean */
+    double ci95;
+};
+
+static void summarize(const double * const v, const unsigned n,
+        struct summary * const sum)
+{
+    /* Two-sided 97.5th percentiles of Student's t for 1 to 30 dof */
+    static const double t975[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+        2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+        2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+        2.042,
+    };
+    double acc = 0;
+    unsigned i;
+
+    *sum = (struct summary) {
+        .n = n,
+        .min = v[0],
+        .max = v[0],
+    };
+    for (i = 0; i < n; i ++) {
+        acc += v[i];
+        if (v[i] < sum->min)
+            sum->min = v[i];
+        if (v[i] > sum->max)
+            sum->max = v[i];
+    }
+    sum->mean = acc / n;
+    if (n < 2)
+        return;
+    acc = 0;
+    for (i = 0; i < n; i ++)
+        acc += (v[i] - sum->mean) * (v[i] - sum->mean);
+    sum->stddev = sqrt(acc / (n - 1));
+    sum->ci95 = (n - 1 <= MMAL_COUNTOF(t975) ? t975[n - 2] : 1.960)
+            * sum->stddev / sqrt(n);
+}
+
+static void show_summary(const char * const name,
+        const struct summary * const sum, const char * const unit)
+{
+    print_info("%s: mean: %e [%s]\n", name, sum->mean, unit);
+    print_info("%s: stddev: %e [%s]\n", name, sum->stddev, unit);
+    print_info("%s: min: %e [%s]\n", name, sum->min, unit);
+    print_info("%s: max: %e [%s]\n", name, sum->max, unit);
+    print_info("%s: 95%% CI: %e +- %e [%s]\n", name,
+            sum->mean, sum->ci95, unit);
+}
+
+static int compare_double(const void * const a, const void * const b)
+{
+    const double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Return: Median of @v, which is sorted in place. */
+static double median_sorted(double * const v, const unsigned n)
+{
+    qsort(v, n, sizeof(*v), compare_double);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/*
+ * Flags values whose modified z-score (Iglewicz and Hoaglin) exceeds 3.5,
+ * i.e. which are far from the median in units of the median absolute
+ * deviation.  The mean absolute deviation is used instead if more than half
+ * of the values are equal.
+ *
+ * Return: 0 on success, or -ENOMEM.
+ */
+static int find_outliers(const double * const v, const unsigned n,
+        _Bool * const is_outlier)
+{
+    double * const tmp = malloc(n * sizeof(*tmp));
+    double median, scale, acc = 0;
+    unsigned i;
+
+    if (tmp == NULL) {
+        print_error("Failed to allocate outlier buffer\n");
+        return -ENOMEM;
+    }
+    memcpy(tmp, v, n * sizeof(*tmp));
+    median = median_sorted(tmp, n);
+    for (i = 0; i < n; i ++) {
+        tmp[i] = fabs(v[i] - median);
+        acc += tmp[i];
+    }
+    scale = median_sorted(tmp, n) / 0.6745;
+    if (scale == 0)
+        scale = acc / n * 1.253314;
+    for (i = 0; i < n; i ++)
+        is_outlier[i] = scale != 0 && fabs(v[i] - median) / scale > 3.5;
+    free(tmp);
+    return 0;
+}
+
+/*
+ * Makes the configuration of instance @k out of @cfg: each instance has its
+ * own -n, or all share the only one given.
+ */
+static void instance_config(const struct bench_config * const cfg,
+        const struct bench_run_options * const opts, const int k,
+        struct bench_config * const c)
+{
+    *c = *cfg;
+    c->instance = k;
+    c->n_instances = opts->instances;
+    if (opts->n_camera_nums > 0)
+        c->camera_num = opts->camera_nums[opts->n_camera_nums == 1 ? 0 : k];
+}
+
+/*
+ * Runs @cfg opts->repeat times on the same components and reports each
+ * trial of each instance, followed by a summary of the trials if there are
+ * more than one.  The instances of a trial are summed up into one value.
+ * @fps, @p99: Set to the mean aggregate frame/s and the mean of the worst p99
+ *             latency among the instances of the trials
+ *
+ * Return: 0 on success, or <0 if @cfg cannot be run.
+ */
+static int run_trials(struct bench * const b,
+        const struct bench_config * const cfg,
+        const struct bench_run_options * const opts, double * const fps,
+        double * const p99)
+{
+    const unsigned n = opts->repeat;
+    const int ni = opts->instances;
+    struct bench_config cfgs[BENCH_INSTANCE_MAX];
+    struct bench_result * const res = malloc(n * ni * sizeof(*res));
+    double * const v_fps = malloc(n * sizeof(*v_fps));
+    double * const v_Bps = malloc(n * sizeof(*v_Bps));
+    double * const v_p99 = malloc(n * sizeof(*v_p99));
+    _Bool * const is_outlier_fps = malloc(n * sizeof(*is_outlier_fps));
+    _Bool * const is_outlier_Bps = malloc(n * sizeof(*is_outlier_Bps));
+    struct summary sum;
+    unsigned i;
+    int k, ret = 0;
+
+    if (res == NULL || v_fps == NULL || v_Bps == NULL || v_p99 == NULL
+            || is_outlier_fps == NULL || is_outlier_Bps == NULL) {
+        print_error("Failed to allocate trial results\n");
+        ret = -ENOMEM;
+        goto out;
+    }
+    for (k = 0; k < ni; k ++)
+        instance_config(cfg, opts, k, &cfgs[k]);
+    for (i = 0; i < n; i ++) {
+        struct bench_result * const r = &res[i * ni];
+        if (n > 1)
+            print_info("Running trial %u of %u\n", i + 1, n);
+        for (k = 0; k < ni; k ++)
+            r[k].trial = i;
+        ret = run_bench(b, cfgs, ni, opts, r);
+        if (ret)
+            goto out;
+        v_fps[i] = r[0].aggregate_fps;
+        v_Bps[i] = r[0].aggregate_Bps;
+        v_p99[i] = 0;
+        for (k = 0; k < ni; k ++)
+            v_p99[i] = MMAL_MAX(v_p99[i], hist_quantile(
+                        &r[k].hops[dest_hop(&cfgs[k])].latency, 0.99));
+    }
+
+    ret = find_outliers(v_fps, n, is_outlier_fps);
+    if (ret == 0)
+        ret = find_outliers(v_Bps, n, is_outlier_Bps);
+    if (ret)
+        goto out;
+    for (i = 0; i < n; i ++) {
+        for (k = 0; k < ni; k ++) {
+            res[i * ni + k].is_outlier = is_outlier_fps[i]
+                    || is_outlier_Bps[i];
+            report_result(opts->format, &cfgs[k], &res[i * ni + k]);
+        }
+        if (ni > 1) {
+            print_info("aggregate: %d instances: %f [frame/s]\n", ni,
+                    v_fps[i]);
+            print_info("aggregate: %d instances: %e [B/s]\n", ni, v_Bps[i]);
+        }
+    }
+    if (n > 1) {
+        summarize(v_fps, n, &sum);
+        show_summary("trials: frame/s", &sum, "frame/s");
+        summarize(v_Bps, n, &sum);
+        show_summary("trials: B/s", &sum, "B/s");
+        for (i = 0; i < n; i ++)
+            if (res[i * ni].is_outlier)
+                print_info("trials: trial %u is an outlier: %f [frame/s], "
+                        "%e [B/s]\n", i + 1, v_fps[i], v_Bps[i]);
+    }
+    summarize(v_fps, n, &sum);
+    *fps = sum.mean;
+    summarize(v_p99, n, &sum);
+    *p99 = sum.mean;
+    if (opts->baseline != NULL) {
+        summarize(v_Bps, n, &sum);
+        ret = check_baseline(opts->baseline, &cfgs[0], &res[0], *fps,
+                sum.mean, *p99);
+    }
+
+out:
+    if (cfg->reuse)
+        for (k = 0; k < ni; k ++)
+            bench_disconnect(&b[k]);
+    free(is_outlier_Bps);
+    free(is_outlier_fps);
+    free(v_p99);
+    free(v_Bps);
+    free(v_fps);
+    free(res);
+    return ret;
+}
+
+/*
+ * Runs the trials on @cfg, or on each buffer number from 1 to
+ * opts->sweep_max if it is not 0.  @b has one bench per instance.
+ *
+ * Return: 0 on success, or <0 if @cfg cannot be run.
+ */
+static int run_cell(struct bench * const b,
+        const struct bench_config * const cfg,
+        const struct bench_run_options * const opts)
+{
+    struct bench_config c = *cfg;
+    struct {
+        _Bool ok;
+        double fps, p99;
+    } *sweep;
+    double fps, p99;
+    unsigned n;
+    int k, ret;
+
+    show_config(cfg);
+    for (k = 0; k < opts->instances; k ++) {
+        instance_config(cfg, opts, k, &c);
+        ret = bench_setup(&b[k], &c);
+        if (ret)
+            return ret;
+    }
+    c = *cfg;
+    if (opts->sweep_max == 0)
+        return run_trials(b, cfg, opts, &fps, &p99);
+
+    /* Depths the ports cannot take are skipped. */
+    sweep = calloc(opts->sweep_max, sizeof(*sweep));
+    if (sweep == NULL) {
+        print_error("Failed to allocate sweep results\n");
+        return -ENOMEM;
+    }
+    for (n = 1; n <= opts->sweep_max; n ++) {
+        c.buffer_num = n;
+        print_info("Running with buffer_num %u\n", n);
+        if (run_trials(b, &c, opts, &fps, &p99))
+            continue;
+        sweep[n - 1].ok = !0;
+        sweep[n - 1].fps = fps;
+        sweep[n - 1].p99 = p99;
+    }
+    for (n = 1; n <= opts->sweep_max; n ++) {
+        if (!sweep[n - 1].ok)
+            print_info("sweep: buffer_num %u: skipped\n", n);
+        else if (!hop_has_ctx(cfg, dest_hop(cfg)))
+            print_info("sweep: buffer_num %u: %f [frame/s]\n", n,
+                    sweep[n - 1].fps);
+        else
+            print_info("sweep: buffer_num %u: %f [frame/s], "
+                    "p99 %.0f [us]\n", n, sweep[n - 1].fps,
+                    sweep[n - 1].p99);
+    }
+    free(sweep);
+    return 0;
+}
+
+/*
+ * Builds the stages and hops of @cfg from @tmpl, using cfg->source and
+ * cfg->dest if -P is not given.  The hops are a chain in the order of the
+ * stages; a hop without its own method uses cfg->conn.  With --split, a
+ * vc.ril.video_splitter goes in before the dest, whose hop becomes the
+ * branch on output 0, and the other branches follow on outputs 1 and up.
+ * cfg->source and cfg->dest are set from the pipeline so that they are
+ * reported as before.
+ */
+void bench_build_graph(struct bench_config * const cfg,
+        const struct bench_graph_template * const tmpl)
+{
+    /* Method of the hop into each stage */
+    int conns[BENCH_STAGE_MAX];
+    int n = 0, i, split = -1;
+
+    if (tmpl->n_stages == 0) {
+        cfg->stages[n] = (struct bench_stage_config) {
+            BENCH_STAGE_SOURCE, cfg->source,
+        };
+        conns[n ++] = -1;
+        cfg->stages[n] = (struct bench_stage_config) {
+            BENCH_STAGE_DEST, cfg->dest,
+        };
+        conns[n ++] = -1;
+    } else {
+        for (n = 0; n < tmpl->n_stages; n ++) {
+            cfg->stages[n] = tmpl->stages[n];
+            conns[n] = tmpl->conns[n];
+        }
+        cfg->source = (enum bench_source) cfg->stages[0].type;
+        cfg->dest = (enum bench_dest) cfg->stages[n - 1].type;
+    }
+    if (tmpl->n_branches != 0) {
+        split = n - 1;
+        cfg->stages[n] = cfg->stages[split];
+        conns[n ++] = conns[split];
+        cfg->stages[split] = (struct bench_stage_config) {
+            BENCH_STAGE_FILTER, BENCH_FILTER_SPLITTER
+        };
+        conns[split] = -1;
+    }
+    cfg->n_stages = n;
+    cfg->n_hops = n - 1;
+    for (i = 0; i < cfg->n_hops; i ++) {
+        cfg->hops[i] = (struct bench_hop_config) {
+            .from = i,
+            .port = i == 0 ? cfg->source_output_port : 0,
+            .to = i + 1,
+            .conn = conns[i + 1] >= 0
+                    ? (enum bench_conn) conns[i + 1] : cfg->conn,
+        };
+    }
+    for (i = 0; i < tmpl->n_branches; i ++) {
+        const int conn = tmpl->branches[i].conn;
+        cfg->stages[cfg->n_stages ++] = (struct bench_stage_config) {
+            BENCH_STAGE_DEST, tmpl->branches[i].dest
+        };
+        cfg->hops[cfg->n_hops ++] = (struct bench_hop_config) {
+            .from = split,
+            .port = i + 1,
+            .to = cfg->n_stages - 1,
+            .conn = conn >= 0 ? (enum bench_conn) conn : cfg->conn,
+            .delay_usec = tmpl->branches[i].delay_usec,
+        };
+    }
+}
+
+/*
+ * Maps cfg->stream_path into cfg->stream with its pages faulted in, so that
+ * feeding it does no file read.  The mapping is left to the exit.
+ *
+ * Return: 0 on success, or <0 if the stream cannot be mapped.
+ */
+int bench_map_stream(struct bench_config * const cfg)
+{
+    struct stat st;
+    void *p;
+    int ret = 0;
+    const int fd = open(cfg->stream_path, O_RDONLY);
+
+    if (fd == -1) {
+        ret = -errno;
+        print_error("Failed to open %s: %s\n", cfg->stream_path,
+                strerror(-ret));
+        return ret;
+    }
+    if (fstat(fd, &st) == -1) {
+        ret = -errno;
+        print_error("Failed to stat %s: %s\n", cfg->stream_path,
+                strerror(-ret));
+        goto close_fd;
+    }
+    if (st.st_size == 0) {
+        print_error("Stream is empty: %s\n", cfg->stream_path);
+        ret = -EINVAL;
+        goto close_fd;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (p == MAP_FAILED) {
+        ret = -errno;
+        print_error("Failed to map %s: %s\n", cfg->stream_path,
+                strerror(-ret));
+        goto close_fd;
+    }
+    cfg->stream = p;
+    cfg->stream_size = st.st_size;
+
+close_fd:
+    close(fd);
+    return ret;
+}
+
+
+/* The benches of the instances, of which opts->instances are run */
+struct bench_pipeline {
+    struct bench benches[BENCH_INSTANCE_MAX];
+};
+
+int bench_pipeline_init(void)
+{
+    open_dtlb_counter();
+    open_gpu_state();
+    try_vcos(vcos_semaphore_create(&run_event.sem, "run_event", 0));
+    return 0;
+}
+
+struct bench_pipeline *bench_pipeline_create(void)
+{
+    struct bench_pipeline * const p = calloc(1, sizeof(*p));
+
+    if (p == NULL)
+        print_error("Failed to allocate a pipeline\n");
+    return p;
+}
+
+void bench_pipeline_destroy(struct bench_pipeline * const p)
+{
+    int i;
+
+    for (i = 0; i < BENCH_INSTANCE_MAX; i ++)
+        bench_teardown(&p->benches[i]);
+    free(p);
+}
+
+int bench_pipeline_run(struct bench_pipeline * const p,
+        const struct bench_config * const cfg,
+        const struct bench_run_options * const opts,
+        struct bench_result * const res)
+{
+    struct bench_config cfgs[BENCH_INSTANCE_MAX];
+    int k, ret;
+
+    for (k = 0; k < opts->instances; k ++) {
+        instance_config(cfg, opts, k, &cfgs[k]);
+        ret = bench_setup(&p->benches[k], &cfgs[k]);
+        if (ret)
+            return ret;
+        res[k].trial = 0;
+    }
+    ret = run_bench(p->benches, cfgs, opts->instances, opts, res);
+    if (cfg->reuse)
+        for (k = 0; k < opts->instances; k ++)
+            bench_disconnect(&p->benches[k]);
+    return ret;
+}
+
+int bench_pipeline_run_cell(struct bench_pipeline * const p,
+        const struct bench_config * const cfg,
+        const struct bench_run_options * const opts)
+{
+    return run_cell(p->benches, cfg, opts);
+}
+
+void bench_pipeline_report(const enum bench_format format,
+        const struct bench_config * const cfg,
+        const struct bench_result * const res)
+{
+    report_result(format, cfg, res);
+}
+
+double bench_hist_quantile(const struct bench_hist * const hist, const double p)
+{
+    return hist_quantile(hist, p);
+}
+
+const char *bench_stage_name(const struct bench_stage_config * const stage)
+{
+    return stage_name(stage);
+}
+
+void bench_free_baseline(struct bench_baseline * const bl)
+{
+    int i;
+
+    for (i = 0; i < bl->n; i ++)
+        free_flat_record(&bl->records[i]);
+    free(bl->records);
+    bl->records = NULL;
+    bl->n = 0;
+}
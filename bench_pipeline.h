@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2018 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef BENCH_PIPELINE_H_
+#define BENCH_PIPELINE_H_
+
+#include <interface/mmal/mmal.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Encoding */
+enum bench_encoding {
+    BENCH_ENCODING_I420 = 0, BENCH_ENCODING_RGBA, BENCH_ENCODING_OPAQUE,
+    BENCH_ENCODING_RGB24, BENCH_ENCODING_BGR24, BENCH_ENCODING_YUYV,
+    BENCH_ENCODING_NV12,
+};
+extern const char * const bench_encoding_table[];
+/* Source */
+enum bench_source {
+    BENCH_SOURCE_SOURCE = 0, BENCH_SOURCE_CAMERA, BENCH_SOURCE_DECODE,
+    BENCH_SOURCE_FILE,
+};
+extern const char * const bench_source_table[];
+/* Codec: elementary stream fed to BENCH_SOURCE_DECODE */
+enum bench_codec {
+    BENCH_CODEC_H264 = 0, BENCH_CODEC_MJPEG,
+};
+extern const char * const bench_codec_table[];
+/* Pattern */
+enum bench_pattern {
+    BENCH_PATTERN_WHITE = 0, BENCH_PATTERN_BLACK, BENCH_PATTERN_DIAGONAL,
+    BENCH_PATTERN_NOISE, BENCH_PATTERN_RANDOM, BENCH_PATTERN_COLOUR,
+    BENCH_PATTERN_BLOCKS, BENCH_PATTERN_SWIRLY,
+};
+extern const char * const bench_pattern_table[];
+/* Filter: components which can go between the source and the dest */
+enum bench_filter {
+    BENCH_FILTER_ISP = 0, BENCH_FILTER_RESIZE, BENCH_FILTER_SPLITTER,
+};
+extern const char * const bench_filter_table[];
+/* Dest */
+enum bench_dest {
+    BENCH_DEST_NULL = 0, BENCH_DEST_RENDER, BENCH_DEST_H264, BENCH_DEST_MJPEG,
+    BENCH_DEST_JPEG, BENCH_DEST_FILE,
+};
+extern const char * const bench_dest_table[];
+/* Profile of BENCH_DEST_H264 */
+enum bench_profile {
+    BENCH_PROFILE_BASELINE = 0, BENCH_PROFILE_MAIN, BENCH_PROFILE_HIGH,
+    BENCH_PROFILE_CONSTRAINED,
+};
+extern const char * const bench_profile_table[];
+/* Conn */
+enum bench_conn {
+    BENCH_CONN_TUNNEL = 0, BENCH_CONN_CALLBACK, BENCH_CONN_QUEUE,
+};
+extern const char * const bench_conn_table[];
+/* Process: ARM-side work on each buffer of a callback or queue connection */
+enum bench_process {
+    BENCH_PROCESS_NONE = 0, BENCH_PROCESS_TOUCH, BENCH_PROCESS_MEMCPY,
+    BENCH_PROCESS_HISTOGRAM, BENCH_PROCESS_BUSY,
+};
+extern const char * const bench_process_table[];
+/*
+ * Arena: what backs the payloads of the pools of callback and queue hops.
+ * none is the allocator of the port for each buffer, as MMAL does.
+ */
+enum bench_arena {
+    BENCH_ARENA_NONE = 0, BENCH_ARENA_ANON, BENCH_ARENA_HUGEPAGE,
+};
+extern const char * const bench_arena_table[];
+/* Format */
+enum bench_format {
+    BENCH_FORMAT_TEXT = 0, BENCH_FORMAT_JSON, BENCH_FORMAT_CSV,
+};
+extern const char * const bench_format_table[];
+/* Maximum number of items in a list option such as -w 640,1280,1920 */
+#define BENCH_LIST_MAX 16
+
+/* Maximum number of components in a pipeline */
+#define BENCH_STAGE_MAX 8
+
+/* Number of output ports of vc.ril.video_splitter */
+#define BENCH_SPLIT_MAX 4
+
+/* Maximum number of pipelines run at the same time */
+#define BENCH_INSTANCE_MAX 8
+
+/* Maximum number of pump threads of a queue connection */
+#define BENCH_WORKER_MAX 8
+
+/* Default -t of a -N run, which is only a timeout there */
+#define BENCH_FRAMES_TIMEOUT_MSEC 60000
+
+/*
+ * A component of the pipeline.  @type is an enum bench_source, enum
+ * bench_filter or enum bench_dest according to @kind.
+ */
+enum bench_stage_kind {
+    BENCH_STAGE_SOURCE = 0, BENCH_STAGE_FILTER, BENCH_STAGE_DEST,
+};
+struct bench_stage_config {
+    enum bench_stage_kind kind;
+    int type;
+};
+
+/*
+ * A connection from output @port of stage @from to input 0 of stage @to.
+ * @delay_usec: Time to hold each buffer on the ARM side before passing it on,
+ *              which makes the consumer a slow one
+ */
+struct bench_hop_config {
+    int from, port, to;
+    enum bench_conn conn;
+    int delay_usec;
+};
+
+/* Everything needed to run one benchmark */
+struct bench_config {
+    enum bench_encoding encoding;
+    int width, height;
+    /* Frame rate to ask the source for, or 0 for as fast as it can */
+    double fps;
+    int msec;
+    /* End the window once this many frames reach the dest, if not 0 */
+    int frames;
+    /* Time to run before the measurement window starts */
+    int warmup_msec;
+    enum bench_source source;
+    enum bench_pattern pattern;
+    int camera_num;
+    int source_output_port;
+    enum bench_dest dest;
+    enum bench_conn conn;
+    _Bool zero_copy;
+    /* 0 to use the ones recommended by the ports */
+    unsigned buffer_num, buffer_size;
+    /*
+     * The pipeline: stages[0] is @source, and the first hop into a dest goes
+     * into @dest.  Hops run with @conn unless the pipeline says otherwise.
+     */
+    int n_stages;
+    struct bench_stage_config stages[BENCH_STAGE_MAX];
+    int n_hops;
+    struct bench_hop_config hops[BENCH_STAGE_MAX];
+    /* Index of this pipeline among the @n_instances run at the same time */
+    int instance, n_instances;
+    /*
+     * Pump threads of each BENCH_CONN_QUEUE hop, the CPUs they are pinned to in
+     * turn if @n_cpus is not 0, and their SCHED_FIFO priority if not 0
+     */
+    int workers;
+    int cpus[BENCH_LIST_MAX], n_cpus;
+    int fifo_priority;
+    /*
+     * Keep the connections of a configuration across its trials; only
+     * mmal_connection_enable/disable are done between them
+     */
+    _Bool reuse;
+    /* Work on each buffer of the ARM-side hops; @process_arg is in usec */
+    enum bench_process process;
+    int process_arg;
+    /* Backing of the payloads of the ARM-side hops */
+    enum bench_arena arena;
+    /*
+     * Of the encoder dests: the bit rate, and the enum bench_profile or -1 and
+     * the intra period or 0 to leave them to the encoder
+     */
+    unsigned bitrate;
+    int profile;
+    int intra_period;
+    /*
+     * Elementary stream fed to BENCH_SOURCE_DECODE, or raw frames of @encoding
+     * packed without padding fed to BENCH_SOURCE_FILE, in a loop.
+     * bench_map_stream() maps it from @stream_path with all its pages
+     * faulted in.
+     */
+    enum bench_codec codec;
+    const char *stream_path;
+    const uint8_t *stream;
+    size_t stream_size;
+    /* Where BENCH_DEST_FILE writes what it receives */
+    const char *sink_path;
+};
+
+/*
+ * Log-linear histogram of latencies in microseconds: values below
+ * BENCH_HIST_SUB_BUCKETS get a bucket each, and every power of two above that
+ * is split into BENCH_HIST_SUB_BUCKETS linear buckets, which bounds the error
+ * of a reported percentile by 1/BENCH_HIST_SUB_BUCKETS of the value.
+ */
+#define BENCH_HIST_SUB_BITS    4
+#define BENCH_HIST_SUB_BUCKETS (1 << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_BUCKETS \
+    (BENCH_HIST_SUB_BUCKETS * (32 - BENCH_HIST_SUB_BITS + 1))
+
+struct bench_hist {
+    unsigned count;
+    unsigned buckets[BENCH_HIST_BUCKETS];
+    double max; /* [us] */
+    /* For the mean and the standard deviation [us] */
+    double sum, sum_sq;
+};
+
+struct bench_baseline;
+
+/* How the configurations are run and reported */
+struct bench_run_options {
+    /* Run each buffer number from 1 to this if not 0 */
+    unsigned sweep_max;
+    /* Number of trials per configuration */
+    unsigned repeat;
+    enum bench_format format;
+    /* Sample the stats every this if not 0 */
+    int interval_msec;
+    /* Where the samples go in @format, or %NULL for print_info */
+    FILE *samples_fp;
+    /* Pipelines to run at the same time, and -n of each of them */
+    int instances;
+    int camera_nums[BENCH_INSTANCE_MAX];
+    int n_camera_nums;
+    /* Results to compare each configuration with, or %NULL */
+    struct bench_baseline *baseline;
+};
+
+/* Time spent in the setup calls since the previous result [s] */
+struct bench_setup_times {
+    double component_create, format_commit, component_destroy;
+    double connection_create, connection_enable, connection_disable;
+    /* Mapping the arenas and creating the pools on them */
+    double arena_alloc;
+};
+
+/*
+ * CPU time and context switches of this process, all threads included, the
+ * ticks of all the CPUs from /proc/stat, and the control messages which
+ * VCHIQ has sent and received, or -1 for them if they are unknown
+ */
+struct bench_cpu_counters {
+    double user, sys;
+    long nvcsw, nivcsw;
+    unsigned long long busy, total;
+    long long vchiq_msgs;
+};
+
+/*
+ * What the firmware says about the GPU, as vcgencmd measure_clock,
+ * measure_temp, get_throttled and get_mem do; -1 where it is unknown.
+ * @throttled has the bits of get_throttled: 0 under-voltage, 1 ARM frequency
+ * capped, 2 throttled and 3 soft temperature limit, now, and the same from
+ * bit 16 if they have occurred since boot.
+ */
+struct bench_gpu_state {
+    int arm_mhz, core_mhz, isp_mhz, h264_mhz;
+    double temp;
+    long long throttled;
+    /* Free relocatable and malloc heap of VideoCore [MB] */
+    int reloc_free_mb, malloc_free_mb;
+};
+
+/* Buffers which went through the ARM side of a non-tunnelled hop */
+struct bench_hop_result {
+    unsigned frame_count;
+    long long total_bytes;
+    double process_time;
+    struct bench_hist latency, interval, pts_latency;
+    unsigned pts_unmapped;
+    unsigned buffer_num, buffer_size;
+};
+
+/* Only vc.ril.source and vc.ril.video_render have the stats */
+struct bench_stage_result {
+    _Bool has_stats;
+    MMAL_PARAMETER_STATISTICS_T stats;
+};
+
+struct bench_result {
+    double elapsed;
+    struct bench_stage_result stages[BENCH_STAGE_MAX];
+    struct bench_hop_result hops[BENCH_STAGE_MAX];
+    /* Index of the trial and whether it is far off the other trials */
+    unsigned trial;
+    _Bool is_outlier;
+    /* Sum of result_fps() and result_Bps() over the instances of the trial */
+    double aggregate_fps, aggregate_Bps;
+    struct bench_setup_times setup;
+    /* Time to the first frame at the dest [s], or <0 if it was not seen */
+    double ttff;
+    /* Data TLB misses of the whole process in the window, or <0 if unknown */
+    long long dtlb_misses;
+    /* In the window; of the whole process and system, shared by instances */
+    struct bench_cpu_counters cpu;
+    /*
+     * At the start and the end of the window, and the worst of the samples
+     * in between: the lowest clocks, the highest temperature and all the
+     * throttled bits seen.  The heaps are only read outside the window, so
+     * they are unknown in @gpu_during.
+     */
+    struct bench_gpu_state gpu_begin, gpu_during, gpu_end;
+};
+
+/*
+ * What the graph of each configuration is built from, as given by -P and
+ * --split.  The conns are enum bench_conn, or -1 to use -c.
+ */
+struct bench_graph_template {
+    /* -P; 0 if not given */
+    int n_stages;
+    struct bench_stage_config stages[BENCH_STAGE_MAX];
+    int conns[BENCH_STAGE_MAX];
+    /* --split, besides the branch into the dest of -P or -d */
+    int n_branches;
+    struct {
+        enum bench_dest dest;
+        int conn;
+        int delay_usec;
+    } branches[BENCH_SPLIT_MAX - 1];
+};
+
+struct bench_flat_record;
+
+/* Results of a previous run which --baseline compares the runs with */
+struct bench_baseline {
+    struct bench_flat_record *records;
+    int n;
+    /* Fraction a result may be worse than its baseline by */
+    double threshold;
+    /* Configurations which regressed or had no records in the baseline */
+    unsigned n_failed;
+};
+
+/*
+ * The benchmark as a library: bench_conn is its command line, and a process
+ * can run the same measurement on its own, e.g. to pick the fastest conn on
+ * the hardware it finds itself on:
+ *
+ *   struct bench_pipeline * const p = bench_pipeline_create();
+ *   if (p == NULL)
+ *       ...
+ *   bench_build_graph(&cfg, &tmpl);
+ *   if (bench_pipeline_run(p, &cfg, &opts, res) == 0)
+ *       ... res[0].aggregate_fps ...
+ *   bench_pipeline_destroy(p);
+ *
+ * bench_pipeline_init() has to be called once before anything else.  None of
+ * these exit: failures are printed and returned, and what a failed run has
+ * set up is kept in @p for the next run or bench_pipeline_destroy().
+ */
+struct bench_pipeline;
+
+/*
+ * Sets up what all the pipelines share: the counters and the run events.
+ *
+ * Return: 0 on success, or -EIO.
+ */
+int bench_pipeline_init(void);
+
+/*
+ * Return: A pipeline with no components yet, or %NULL if it cannot be
+ * allocated.  The components are created by the first run and kept for the
+ * next ones which need the same stages.
+ */
+struct bench_pipeline *bench_pipeline_create(void);
+
+/* Destroys @p and all of its components. */
+void bench_pipeline_destroy(struct bench_pipeline * const p);
+
+/*
+ * Runs @cfg, whose graph bench_build_graph() has built, once on the
+ * opts->instances instances of @p, and fills @res, one per instance.
+ *
+ * Return: 0 on success, or <0 if @cfg cannot be run.
+ */
+int bench_pipeline_run(struct bench_pipeline * const p,
+        const struct bench_config * const cfg,
+        const struct bench_run_options * const opts,
+        struct bench_result * const res);
+
+/*
+ * Runs @cfg as bench_conn does: opts->repeat trials, or a sweep of the
+ * buffer numbers, each reported in opts->format, and compared with
+ * opts->baseline if it is set.
+ *
+ * Return: 0 on success, or <0 if @cfg cannot be run.
+ */
+int bench_pipeline_run_cell(struct bench_pipeline * const p,
+        const struct bench_config * const cfg,
+        const struct bench_run_options * const opts);
+
+/* Reports @res of @cfg in @format as bench_pipeline_run_cell() does. */
+void bench_pipeline_report(const enum bench_format format,
+        const struct bench_config * const cfg,
+        const struct bench_result * const res);
+
+/* Return: The @p quantile of @hist [us]. */
+double bench_hist_quantile(const struct bench_hist * const hist,
+        const double p);
+
+/* Return: The name of @stage as -P takes it. */
+const char *bench_stage_name(const struct bench_stage_config * const stage);
+
+/*
+ * Builds cfg->stages and cfg->hops from @tmpl: the stages of -P, or
+ * cfg->source into cfg->dest if @tmpl has none, with a splitter before the
+ * dest and the branches of --split after it.  cfg->source and cfg->dest are
+ * set from the stages.  To be called again whenever the fields it uses
+ * change.
+ */
+void bench_build_graph(struct bench_config * const cfg,
+        const struct bench_graph_template * const tmpl);
+
+/*
+ * Maps cfg->stream_path read only with all its pages faulted in, and sets
+ * cfg->stream and cfg->stream_size to it.  The mapping is never unmapped; it
+ * lasts as long as the process, and @cfg and its copies may all point to it.
+ *
+ * Return: 0 on success, or <0 if the file cannot be mapped or is empty, in
+ * which case @cfg is left as it was.
+ */
+int bench_map_stream(struct bench_config * const cfg);
+
+/*
+ * Loads @path, as --format=json wrote it, into bl->records and bl->n of
+ * @bl, which must be empty, e.g. zeroed.  bl->threshold is left to the
+ * caller to set, and bl->n_failed counts up as runs are compared.  The
+ * caller frees the records with bench_free_baseline().
+ *
+ * Return: 0 on success, or <0 if @path cannot be read, is not one record
+ * per line or has none, in which case @bl is left empty.
+ */
+int bench_load_baseline(const char * const path,
+        struct bench_baseline * const bl);
+
+/*
+ * Frees the records which bench_load_baseline() has loaded into @bl, but not
+ * @bl itself, and leaves it empty.
+ */
+void bench_free_baseline(struct bench_baseline * const bl);
+
+#endif /* BENCH_PIPELINE_H_ */
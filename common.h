@@ -12,6 +12,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <interface/vcos/vcos_types.h>
 #include <interface/mmal/mmal.h>
 #include <time.h>
@@ -48,17 +49,45 @@
         } \
     } while (0)
 
+/*
+ * As check_mmal() and check_vcos(), but return -EIO from the calling function
+ * instead of exiting, for the library, which must not end the process it is
+ * linked into.
+ */
+#define try_mmal(x) \
+    do { \
+        MMAL_STATUS_T status = (x); \
+        if (status != MMAL_SUCCESS) { \
+            print_error("MMAL call failed: %s (0x%08x)\n", \
+                    mmal_status_to_string(status), status); \
+            return -EIO; \
+        } \
+    } while (0)
+
+#define try_vcos(x) \
+    do { \
+        VCOS_STATUS_T status = (x); \
+        if (status != VCOS_SUCCESS) { \
+            print_error("VCOS call failed: 0x%08x\n", status); \
+            return -EIO; \
+        } \
+    } while (0)
+
 
-#define config_port(port, enc, width, height) \
+/* Returns -EIO from the calling function if the format is not taken. */
+#define config_port(port, enc, frame_width, frame_height) \
     do { \
         port->format->encoding = enc; \
-        port->format->es->video.width  = VCOS_ALIGN_UP(width,  32); \
-        port->format->es->video.height = VCOS_ALIGN_UP(height, 16); \
+        /* Opaque buffers need the format of the image they refer to. */ \
+        port->format->encoding_variant = \
+                (enc) == MMAL_ENCODING_OPAQUE ? MMAL_ENCODING_I420 : 0; \
+        port->format->es->video.width  = VCOS_ALIGN_UP((frame_width),  32); \
+        port->format->es->video.height = VCOS_ALIGN_UP((frame_height), 16); \
         port->format->es->video.crop.x = 0; \
         port->format->es->video.crop.y = 0; \
-        port->format->es->video.crop.width  = width; \
-        port->format->es->video.crop.height = height; \
-        check_mmal(mmal_port_format_commit(port)); \
+        port->format->es->video.crop.width  = (frame_width); \
+        port->format->es->video.crop.height = (frame_height); \
+        try_mmal(mmal_port_format_commit(port)); \
     } while (0)
 
     static inline double get_time(void)